@@ -1,162 +1,496 @@
 #!/usr/bin/env python3
+"""Symbolizes the call stacks of a trace into a side table per PE,
+psym.NNN.csv next to the trace, instead of rewriting the trace itself:
+
+    Address,Module,Offset,Symbol
+
+Symbol is the frame's inline chain, innermost first and '|' separated, each
+entry `function (file:line)`. The wrappers are inlined into the caller, so
+the chain is what leads back to the application's source line.
+
+Binary traces list every object the process had loaded, with its build id,
+so frames in shared libraries resolve too and the binary argument is only
+needed if the program has moved. csv traces, and traces from macOS, only
+carry the program's slide and are symbolized against the binary given.
+
+Every address is symbolized once: results are kept in an sqlite index keyed
+by build id and offset, $OSH_SYMBOL_CACHE or
+~/.cache/oshtrace/symbols.sqlite. DWARF is read in-process with libdw when
+it is installed, otherwise with one addr2line (atos on macOS) run per object.
+
+usage: backtrace_of_stacktrace.py [binary]"""
+import bisect
 import csv
+import ctypes
+import ctypes.util
 import glob
+import mmap
 import os
-import sys
-import subprocess
-import tempfile
-import shutil
 import platform
+import sqlite3
+import struct
+import subprocess
+import sys
+
+import bin_to_csv
+
+BLOCK_MODULES = 8
+MODULE = struct.Struct('<QQQII')
+
+DW_TAG_inlined_subroutine = 0x1d
+DW_TAG_subprogram = 0x2e
+DW_AT_name = 0x03
+DW_AT_call_file = 0x58
+DW_AT_call_line = 0x59
+DW_AT_linkage_name = 0x6e
+
+
+class Module:
+    """A loaded object: what it is, and where it was in the traced process."""
+
+    def __init__(self, path, bias, start, end, build_id=''):
+        self.path = path
+        self.bias = bias
+        self.start = start
+        self.end = end
+        self.build_id = build_id
+
+    def key(self):
+        """The cache key. Objects without a build id fall back to their
+        path, size and modification time."""
+        if self.build_id:
+            return self.build_id
+        try:
+            st = os.stat(self.path)
+            return f"{self.path}:{st.st_size}:{st.st_mtime_ns}"
+        except OSError:
+            return None
+
+
+class Trace:
+    """Addresses and modules of one PE."""
+
+    def __init__(self, directory, pe):
+        self.out_name = os.path.join(directory, f"psym.{pe:03d}.csv")
+        self.heap_name = os.path.join(directory, f"pheap.{pe:03d}.csv")
+        self.modules = []
+        self.program = None
+        self.slide = None
+        self.addrs = set()
 
-def symbolize_addresses(addresses, binary, slide=None):
-    if not binary or not os.path.exists(binary):
-        return {addr: addr for addr in addresses}
-    
-    valid_addrs = [a for a in addresses if a.startswith('0x')]
-    if not valid_addrs:
-        return {addr: addr for addr in addresses}
-    
-    sym_map = {addr: addr for addr in addresses}
-    system = platform.system()
-    
+    def module_of(self, addr):
+        i = bisect.bisect_right([m.start for m in self.modules], addr) - 1
+        if i >= 0 and addr < self.modules[i].end:
+            return self.modules[i]
+        return None
+
+
+def program_module(binary, slide):
+    """The binary alone, for traces without a module list. Its range is that
+    of its PT_LOAD segments so addresses in other objects are left out; an
+    ELF executable that is not position independent is not slid."""
+    with open(binary, 'rb') as f:
+        elf = f.read(64)
+        if elf[:4] != b'\x7fELF' or elf[4] != 2:
+            return Module(binary, slide or 0, 0, 1 << 64)
+        e_type, = struct.unpack_from('<H', elf, 16)
+        e_phoff, = struct.unpack_from('<Q', elf, 32)
+        e_phentsize, e_phnum = struct.unpack_from('<HH', elf, 54)
+        f.seek(e_phoff)
+        phdrs = f.read(e_phentsize * e_phnum)
+    lo, hi = 1 << 64, 0
+    for i in range(e_phnum):
+        p_type, _, _, p_vaddr, _, _, p_memsz = struct.unpack_from(
+            '<IIQQQQQ', phdrs, i * e_phentsize)
+        if p_type == 1:
+            lo, hi = min(lo, p_vaddr), max(hi, p_vaddr + p_memsz)
+    bias = 0 if e_type == 2 else slide or 0
+    return Module(binary, bias, bias + lo, bias + hi)
+
+
+def parse_modules(payload):
+    off = 0
+    while off + MODULE.size <= len(payload):
+        bias, start, end, path_len, build_id_len = MODULE.unpack_from(payload, off)
+        path = payload[off + MODULE.size:off + MODULE.size + path_len - 1]
+        build_id = payload[off + MODULE.size + path_len:
+                           off + MODULE.size + path_len + build_id_len]
+        yield Module(path.decode(errors='replace'), bias, start, end, build_id.hex())
+        off += (MODULE.size + path_len + build_id_len + 7) & ~7
+
+
+def read_bin(filename, traces):
+    with open(filename, 'rb') as f:
+        if os.fstat(f.fileno()).st_size == 0:
+            return
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+            for btype, tid, pe, payload in bin_to_csv.read_blocks(
+                    m, filename, (bin_to_csv.BLOCK_HEADER, bin_to_csv.BLOCK_STACKS,
+                                  BLOCK_MODULES)):
+                if btype not in (bin_to_csv.BLOCK_HEADER, bin_to_csv.BLOCK_STACKS,
+                                 BLOCK_MODULES):
+                    continue
+                t = traces.setdefault(pe, Trace(os.path.dirname(filename), pe))
+                if btype == bin_to_csv.BLOCK_HEADER:
+                    t.slide = bin_to_csv.HEADER.unpack_from(payload)[8]
+                elif btype == bin_to_csv.BLOCK_STACKS:
+                    for _, frames in bin_to_csv.parse_stacks(payload):
+                        t.addrs.update(frames)
+                else:
+                    # a list written after a dlopen adds to the earlier ones
+                    found = list(parse_modules(payload))
+                    if t.program is None and found:
+                        t.program = (found[0].start, found[0].end)
+                    known = {(m.start, m.end): m for m in t.modules}
+                    known.update(((m.start, m.end), m) for m in found)
+                    t.modules = sorted(known.values(), key=lambda m: m.start)
+
+
+def read_csv(filename, traces):
+    """A pperf.NNN.csv, with its stacks in pstack.NNN.csv or in every row."""
     try:
-        if system == "Darwin":
-            cmd = ["atos", "-o", binary]
-            if slide:
-                cmd.extend(["-s", slide])
-            else:
-                print(f"warning: no slide found in csv, assuming slide = 0. symbols may be wildly incorrect")
-
-            cmd += valid_addrs
-            # print(f"running: {' '.join(cmd)}")
-            result = subprocess.run(cmd, capture_output=True, text=True, check=True)
-            symbols = result.stdout.splitlines()
-            for i, addr in enumerate(valid_addrs):
-                if i < len(symbols):
-                    sym_map[addr] = symbols[i]
-        else:
-            effective_addrs = valid_addrs
-            if slide:
-                try:
-                    is_pie = False
-                    try:
-                        res = subprocess.run(["readelf", "-h", binary], capture_output=True, text=True)
-                        if "Type:" in res.stdout and "DYN" in res.stdout:
-                            is_pie = True
-                    except Exception:
-                        pass
-
-                    slide_val = int(slide, 16)
-                    if is_pie and slide_val != 0:
-                        effective_addrs = [hex(int(a, 16) - slide_val) for a in valid_addrs]
-                except ValueError:
-                    print(f"Warning: invalid slide value {slide}")
-            
-            cmd = ["addr2line", "-e", binary, "-f", "-C"] + effective_addrs
-            result = subprocess.run(cmd, capture_output=True, text=True, check=True)
-            lines = result.stdout.splitlines()
-            # two lines per address: function name \n file:line
-            for i, addr in enumerate(valid_addrs):
-                if 2 * i + 1 < len(lines):
-                    func = lines[2 * i]
-                    loc = lines[2 * i + 1]
-                    # morph output to match mac
-                    sym_map[addr] = f"{func} ({loc})"
-        print(f"registered {len(sym_map)} symbols")    
-        return sym_map
-    except Exception as e:
-        print(f"symbolization failed for {binary} on {system}: {e}")
-        return sym_map
-
-def append_symboltrace_column(pattern="pperf.*.csv", binary="a.out"):
-    files = glob.glob(pattern)
-    if not files:
-        print(f"no files matching {pattern} found")
+        pe = int(os.path.basename(filename).split('.')[1])
+    except ValueError:
+        pe = 0
+    t = traces.setdefault(pe, Trace(os.path.dirname(filename), pe))
+    stacks = bin_to_csv.stack_table_name(filename)
+    with open(filename, 'r') as f:
+        for row in csv.DictReader(f):
+            if t.slide is None and row.get('Function') in ('shmem_init',
+                                                          'shmem_init_thread'):
+                for part in row.get('Extra', '').split(';'):
+                    if part.strip().startswith('slide='):
+                        t.slide = int(part.strip()[6:], 16)
+            if not os.path.exists(stacks):
+                t.addrs.update(parse_addrs(row.get('Stacktrace', '')))
+            elif t.slide is not None:
+                break
+    if os.path.exists(stacks):
+        with open(stacks, 'r') as f:
+            for row in csv.DictReader(f):
+                t.addrs.update(parse_addrs(row.get('Stacktrace', '')))
+
+
+def read_heap(t):
+    """The call sites in the heap report, pheap.NNN.csv, if there is one."""
+    if not os.path.exists(t.heap_name):
         return
+    with open(t.heap_name, 'r') as f:
+        for row in csv.DictReader(f):
+            t.addrs.update(parse_addrs(row.get('Stacktrace', '')))
 
-    slide_groups = {}
-    
-    # identify slides and collect addresses per file
-    for f in files:
-        slide = None
-        current_addrs = set()
-        file_rows = []
-        
+
+def parse_addrs(stacktrace):
+    return (int(a, 16) for a in stacktrace.split('|') if a.strip().startswith('0x'))
+
+
+class Libdw:
+    """Symbolizes with elfutils' libdwfl, loaded through ctypes."""
+
+    class Callbacks(ctypes.Structure):
+        _fields_ = [('find_elf', ctypes.c_void_p),
+                    ('find_debuginfo', ctypes.c_void_p),
+                    ('section_address', ctypes.c_void_p),
+                    ('debuginfo_path', ctypes.POINTER(ctypes.c_char_p))]
+
+    class Die(ctypes.Structure):
+        _fields_ = [('addr', ctypes.c_void_p), ('cu', ctypes.c_void_p),
+                    ('abbrev', ctypes.c_void_p), ('padding', ctypes.c_long)]
+
+    class Attribute(ctypes.Structure):
+        _fields_ = [('code', ctypes.c_uint), ('form', ctypes.c_uint),
+                    ('valp', ctypes.c_void_p), ('cu', ctypes.c_void_p)]
+
+    def __init__(self):
+        name = ctypes.util.find_library('dw') or 'libdw.so.1'
+        lib = self.lib = ctypes.CDLL(name)
+        vp, u64 = ctypes.c_void_p, ctypes.c_uint64
+        die_p = ctypes.POINTER(self.Die)
+        attr_p = ctypes.POINTER(self.Attribute)
+        for fn, res, args in (
+                ('dwfl_begin', vp, [vp]),
+                ('dwfl_end', None, [vp]),
+                ('dwfl_report_elf', vp, [vp, ctypes.c_char_p, ctypes.c_char_p,
+                                         ctypes.c_int, u64, ctypes.c_bool]),
+                ('dwfl_report_end', ctypes.c_int, [vp, vp, vp]),
+                ('dwfl_module_addrname', ctypes.c_char_p, [vp, u64]),
+                ('dwfl_module_addrdie', die_p, [vp, u64, ctypes.POINTER(u64)]),
+                ('dwfl_module_getsrc', vp, [vp, u64]),
+                ('dwfl_lineinfo', ctypes.c_char_p,
+                 [vp, vp, ctypes.POINTER(ctypes.c_int), vp, vp, vp]),
+                ('dwarf_getscopes', ctypes.c_int, [die_p, u64, ctypes.POINTER(die_p)]),
+                ('dwarf_getscopes_die', ctypes.c_int, [die_p, ctypes.POINTER(die_p)]),
+                ('dwarf_tag', ctypes.c_int, [die_p]),
+                ('dwarf_attr_integrate', attr_p, [die_p, ctypes.c_uint, attr_p]),
+                ('dwarf_formstring', ctypes.c_char_p, [attr_p]),
+                ('dwarf_formudata', ctypes.c_int, [attr_p, ctypes.POINTER(u64)]),
+                ('dwarf_getsrcfiles', ctypes.c_int,
+                 [die_p, ctypes.POINTER(vp), ctypes.POINTER(ctypes.c_size_t)]),
+                ('dwarf_filesrc', ctypes.c_char_p, [vp, ctypes.c_size_t, vp, vp])):
+            f = getattr(lib, fn)
+            f.restype = res
+            f.argtypes = args
+        self.libc = ctypes.CDLL(None)
+        self.libc.free.argtypes = [vp]
+        self.demangler = Demangler()
+        # kept alive for as long as any Dwfl uses them
+        self.debuginfo_path = ctypes.c_char_p(None)
+        self.callbacks = self.Callbacks(
+            ctypes.cast(lib.dwfl_build_id_find_elf, vp).value,
+            ctypes.cast(lib.dwfl_standard_find_debuginfo, vp).value,
+            ctypes.cast(lib.dwfl_offline_section_address, vp).value,
+            ctypes.pointer(self.debuginfo_path))
+
+    def symbolize(self, path, offsets):
+        lib = self.lib
+        dwfl = lib.dwfl_begin(ctypes.byref(self.callbacks))
+        try:
+            mod = lib.dwfl_report_elf(dwfl, b'm', path.encode(), -1, 0, False)
+            lib.dwfl_report_end(dwfl, None, None)
+            if not mod:
+                return {}
+            return {off: self.frames(mod, off - 1) for off in offsets}
+        finally:
+            lib.dwfl_end(dwfl)
+
+    def attr_string(self, die, *names):
+        attr = self.Attribute()
+        for name in names:
+            a = self.lib.dwarf_attr_integrate(die, name, ctypes.byref(attr))
+            if a:
+                s = self.lib.dwarf_formstring(a)
+                if s:
+                    return s.decode(errors='replace')
+        return None
+
+    def attr_int(self, die, name):
+        attr = self.Attribute()
+        value = ctypes.c_uint64()
+        a = self.lib.dwarf_attr_integrate(die, name, ctypes.byref(attr))
+        if a and self.lib.dwarf_formudata(a, ctypes.byref(value)) == 0:
+            return value.value
+        return None
+
+    def frames(self, mod, pc):
+        """The inline chain at pc, innermost first, as eu-addr2line -i."""
+        lib = self.lib
+        line = lib.dwfl_module_getsrc(mod, pc)
+        lineno = ctypes.c_int()
+        src = lib.dwfl_lineinfo(line, None, ctypes.byref(lineno), None, None,
+                                None) if line else None
+        loc = f"{src.decode(errors='replace')}:{lineno.value}" if src else '??:0'
+
+        bias = ctypes.c_uint64()
+        cu = lib.dwfl_module_addrdie(mod, pc, ctypes.byref(bias))
+        if not cu:
+            return [self.symtab(mod, pc, loc)]
+        files = ctypes.c_void_p()
+        n_files = ctypes.c_size_t()
+        if lib.dwarf_getsrcfiles(cu, ctypes.byref(files), ctypes.byref(n_files)) != 0:
+            files = None
+
+        chain = []
+        scopes = ctypes.POINTER(self.Die)()
+        n = lib.dwarf_getscopes(cu, pc - bias.value, ctypes.byref(scopes))
+        i = 0
+        while i < n:
+            die = ctypes.pointer(scopes[i])
+            tag = lib.dwarf_tag(die)
+            if tag not in (DW_TAG_subprogram, DW_TAG_inlined_subroutine):
+                i += 1
+                continue
+            name = self.attr_string(die, DW_AT_linkage_name, DW_AT_name) or '??'
+            chain.append(f"{self.demangler(name)} ({loc})")
+            if tag == DW_TAG_subprogram:
+                break
+            # the caller's line is where this was inlined, and its scopes
+            # continue from the inlined instance
+            call_file = self.attr_int(die, DW_AT_call_file)
+            call_line = self.attr_int(die, DW_AT_call_line)
+            src = (lib.dwarf_filesrc(files, call_file, None, None)
+                   if files and call_file is not None else None)
+            loc = f"{src.decode(errors='replace') if src else '??'}:{call_line or 0}"
+            outer = ctypes.POINTER(self.Die)()
+            n_outer = lib.dwarf_getscopes_die(die, ctypes.byref(outer))
+            self.libc.free(ctypes.cast(scopes, ctypes.c_void_p))
+            scopes, n, i = outer, n_outer, 1
+        if n > 0:
+            self.libc.free(ctypes.cast(scopes, ctypes.c_void_p))
+        return chain or [self.symtab(mod, pc, loc)]
+
+    def symtab(self, mod, pc, loc):
+        # no debug info for pc, only the ELF symbol table
+        name = self.lib.dwfl_module_addrname(mod, pc)
+        name = self.demangler(name.decode(errors='replace')) if name else '??'
+        return f"{name} ({loc})"
+
+
+class Demangler:
+    """C++ names through libstdc++'s __cxa_demangle, if there is one."""
+
+    def __init__(self):
+        try:
+            lib = ctypes.CDLL(ctypes.util.find_library('stdc++') or 'libstdc++.so.6')
+            self.fn = lib.__cxa_demangle
+            self.fn.restype = ctypes.c_void_p
+            self.fn.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p,
+                                ctypes.POINTER(ctypes.c_int)]
+            self.free = ctypes.CDLL(None).free
+            self.free.argtypes = [ctypes.c_void_p]
+        except (OSError, AttributeError):
+            self.fn = None
+
+    def __call__(self, name):
+        if not self.fn or not name.startswith('_Z'):
+            return name
+        status = ctypes.c_int()
+        p = self.fn(name.encode(), None, None, ctypes.byref(status))
+        if status.value != 0 or not p:
+            return name
+        demangled = ctypes.string_at(p).decode(errors='replace')
+        self.free(p)
+        return demangled
+
+
+class Addr2line:
+    """The fallback: one addr2line run per object, or atos on macOS."""
+
+    def symbolize(self, path, offsets):
+        offsets = sorted(offsets)
+        pcs = '\n'.join(hex(off - 1) for off in offsets) + '\n'
+        if platform.system() == "Darwin":
+            cmd = ["atos", "-o", path]
+        else:
+            cmd = ["addr2line", "-a", "-i", "-f", "-C", "-e", path]
         try:
-            with open(f, 'r') as csvfile:
-                reader = csv.DictReader(csvfile)
-                file_rows = list(reader)
-                
-                for row in file_rows:
-                    if row.get('Function') == 'shmem_init':
-                        extra = row.get('Extra', '')
-                        if 'slide=' in extra:
-                            parts = extra.split(';')
-                            for p in parts:
-                                if p.strip().startswith('slide='):
-                                    slide = p.strip().split('=')[1]
-                                    break
-                    if slide:
-                        break
-                
-                for row in file_rows:
-                    stacktrace = row.get('Stacktrace', '')
-                    if stacktrace:
-                        for addr in stacktrace.split('|'):
-                            addr = addr.strip()
-                            if addr:
-                                current_addrs.add(addr)
-                                
-            if slide not in slide_groups:
-                slide_groups[slide] = {'addresses': set(), 'files': []}
-            slide_groups[slide]['addresses'].update(current_addrs)
-            slide_groups[slide]['files'].append(f)
-            
-        except Exception as e:
-            print(f"Error reading {f}: {e}")
-            continue
-
-    for slide, group in slide_groups.items():
-        print(f"Processing group with slide={slide} ({len(group['files'])} files)")
-        
-        symbol_map = symbolize_addresses(group['addresses'], binary, slide=slide)
-        
-        for f in group['files']:
-            print(f"updating {f}...")
-            temp_fd, temp_path = tempfile.mkstemp()
-            try:
-                with os.fdopen(temp_fd, 'w', newline='') as temp_file:
-                    with open(f, 'r') as csvfile:
-                        reader = csv.DictReader(csvfile)
-                        fieldnames = reader.fieldnames
-                        if fieldnames is None:
-                            continue
-                        
-                        if 'Symboltrace' not in fieldnames:
-                            fieldnames = list(fieldnames) + ['Symboltrace']
-                        
-                        writer = csv.DictWriter(temp_file, fieldnames=fieldnames)
-                        writer.writeheader()
-                        
-                        for row in reader:
-                            stacktrace = row.get('Stacktrace', '')
-                            symbols = []
-                            if stacktrace:
-                                for addr in stacktrace.split('|'):
-                                    addr = addr.strip()
-                                    if addr:
-                                        symbols.append(symbol_map.get(addr, addr))
-                            
-                            row['Symboltrace'] = '|'.join(symbols)
-                            writer.writerow(row)
-                
-                shutil.move(temp_path, f)
-            except Exception as e:
-                print(f"failed to update {f}: {e}")
-                if os.path.exists(temp_path):
-                    os.remove(temp_path)
+            out = subprocess.run(cmd, input=pcs, capture_output=True, text=True,
+                                 check=True).stdout.splitlines()
+        except (OSError, subprocess.CalledProcessError) as e:
+            print(f"symbolization failed for {path}: {e}")
+            return {}
+        if cmd[0] == "atos":
+            return {off: [line] for off, line in zip(offsets, out)}
+
+        # -a prints each address, then function and file:line per inline level
+        result = {}
+        chain = []
+        it = iter(out)
+        for line in it:
+            if line.startswith('0x'):
+                chain = result.setdefault(int(line, 16) + 1, [])
+            else:
+                chain.append(f"{line} ({next(it, '??:0')})")
+        return result
+
+
+class Cache:
+    """(module key, offset) -> symbol chain, on disk."""
+
+    def __init__(self):
+        path = os.environ.get('OSH_SYMBOL_CACHE') or os.path.join(
+            os.path.expanduser('~'), '.cache', 'oshtrace', 'symbols.sqlite')
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        self.db = sqlite3.connect(path)
+        self.db.execute('CREATE TABLE IF NOT EXISTS symbols (module TEXT, '
+                        'offset INTEGER, symbol TEXT, PRIMARY KEY (module, offset))')
+
+    def lookup(self, key, offsets):
+        found = {}
+        offsets = list(offsets)
+        for i in range(0, len(offsets), 500):
+            chunk = offsets[i:i + 500]
+            q = ('SELECT offset, symbol FROM symbols WHERE module = ? AND offset IN (' +
+                 ','.join('?' * len(chunk)) + ')')
+            for off, symbol in self.db.execute(q, [key] + [to_sql(o) for o in chunk]):
+                found[from_sql(off)] = symbol
+        return found
+
+    def store(self, key, symbols):
+        self.db.executemany('INSERT OR REPLACE INTO symbols VALUES (?, ?, ?)',
+                            ((key, to_sql(off), s) for off, s in symbols.items()))
+        self.db.commit()
+
+
+# sqlite integers are signed
+def to_sql(offset):
+    return offset - (1 << 64) if offset >= 1 << 63 else offset
+
+
+def from_sql(offset):
+    return offset + (1 << 64) if offset < 0 else offset
+
+
+def symbolize(traces, binary):
+    try:
+        backend = Libdw()
+    except (OSError, AttributeError):
+        backend = Addr2line()
+    cache = Cache()
+
+    # (pe, address) -> (module, offset), and every offset wanted per object
+    frames = {}
+    wanted = {}
+    for pe, t in traces.items():
+        if not t.modules:
+            if not binary:
+                print(f"PE {pe}: no module list in the trace, pass the binary")
+                continue
+            t.modules = [program_module(binary, t.slide)]
+        elif binary:
+            # the program is the first module of the first list
+            for m in t.modules:
+                if (m.start, m.end) == t.program:
+                    m.path = binary
+        for addr in t.addrs:
+            m = t.module_of(addr)
+            if m is None:
+                continue
+            key = m.key()
+            frames[(pe, addr)] = (m, addr - m.bias, key)
+            if key:
+                wanted.setdefault(key, (m.path, set()))[1].add(addr - m.bias)
+
+    resolved = {}
+    for key, (path, offsets) in wanted.items():
+        symbols = cache.lookup(key, offsets)
+        missing = offsets - symbols.keys()
+        if missing and os.path.exists(path):
+            new = {off: '|'.join(chain)
+                   for off, chain in backend.symbolize(path, missing).items()}
+            cache.store(key, new)
+            symbols.update(new)
+        print(f"{path}: {len(offsets)} addresses, {len(offsets) - len(missing)} cached")
+        resolved[key] = symbols
+
+    for pe, t in traces.items():
+        with open(t.out_name, 'w', newline='') as f:
+            w = csv.writer(f)
+            w.writerow(['Address', 'Module', 'Offset', 'Symbol'])
+            for addr in sorted(t.addrs):
+                m, off, key = frames.get((pe, addr), (None, 0, None))
+                symbol = resolved.get(key, {}).get(off, '')
+                w.writerow([hex(addr), m.path if m else '', hex(off) if m else '',
+                            symbol])
+        print(f"wrote {len(t.addrs)} addresses to {t.out_name}")
+
 
 if __name__ == "__main__":
-    binary_to_use = sys.argv[1] if len(sys.argv) > 1 else "a.out"
-    append_symboltrace_column(binary=binary_to_use)
+    binary = sys.argv[1] if len(sys.argv) > 1 else None
+    if binary and not os.path.exists(binary):
+        print(f"{binary} not found")
+        sys.exit(1)
+    traces = {}
+    files = sorted(glob.glob("pperf.*.bin"))
+    for f in files:
+        read_bin(f, traces)
+    if not files:
+        files = sorted(glob.glob("pperf.*.csv"))
+        for f in files:
+            read_csv(f, traces)
+    if not files:
+        print("no pperf.*.bin or pperf.*.csv found")
+        sys.exit(1)
+    for t in traces.values():
+        read_heap(t)
+    symbolize(traces, binary)
     print("done")
@@ -0,0 +1,62 @@
+// times a loop of puts and one of atomics to the next PE. elide.sh builds
+// it uninstrumented, with RMA and AMO compiled out of the wrapper, and fully
+// traced, then compares the three
+#define SHMEM_PERF_SETUP
+#include <shmem.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// noinline so elide.sh can compare their code between builds
+__attribute__((noinline)) void bench_rma(long *x, int pe, long iters) {
+  for (long i = 0; i < iters; i++) {
+    shmem_long_p(x, i, pe);
+  }
+}
+
+__attribute__((noinline)) long bench_amo(long *x, int pe, long iters) {
+  long sum = 0;
+  for (long i = 0; i < iters; i++) {
+    sum += shmem_long_atomic_fetch_inc(x, pe);
+  }
+  return sum;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+  long iters = argc > 1 ? atol(argv[1]) : 1000000;
+
+  shmem_init();
+  int me = shmem_my_pe();
+  int pe = (me + 1) % shmem_n_pes();
+  long *x = (long *)shmem_malloc(sizeof(long));
+
+  // one untimed round to warm up
+  bench_rma(x, pe, iters / 10);
+  shmem_quiet();
+  shmem_barrier_all();
+
+  double t0 = now();
+  bench_rma(x, pe, iters);
+  shmem_quiet();
+  double t1 = now();
+  shmem_barrier_all();
+
+  double t2 = now();
+  long sum = bench_amo(x, pe, iters / 10);
+  double t3 = now();
+  shmem_barrier_all();
+
+  if (me == 0) {
+    printf("put         %8.1f ns/call\n", (t1 - t0) * 1e9 / iters);
+    printf("fetch_inc   %8.1f ns/call\n", (t3 - t2) * 1e9 / (iters / 10));
+  }
+  shmem_free(x);
+  shmem_finalize();
+  return sum == -1;
+}
@@ -0,0 +1,50 @@
+#!/bin/bash
+# builds elide.c three ways: plain oshcc, poshcc with RMA and AMO compiled
+# out of the wrapper, and poshcc fully traced. runs each, and checks that
+# the bench loops of the elided build are the same code as the plain one
+#
+#   OSHCC, POSHCC, OSHRUN and ITERS override the defaults below
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+OSHCC=${OSHCC:-oshcc}
+POSHCC=${POSHCC:-$here/../poshcc}
+OSHRUN=${OSHRUN:-oshrun -n 2}
+ITERS=${ITERS:-1000000}
+CFLAGS="-O2 -g"
+
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+
+$OSHCC $CFLAGS -o "$build/plain" "$here/elide.c"
+$POSHCC $CFLAGS -DOSH_TRACE_RMA=0 -DOSH_TRACE_AMO=0 -o "$build/elided" \
+  "$here/elide.c"
+$POSHCC $CFLAGS -o "$build/traced" "$here/elide.c"
+
+# traces go to the scratch directory
+for v in plain elided traced; do
+  echo "== $v"
+  (cd "$build" && $OSHRUN "./$v" "$ITERS")
+done
+
+# one function's instructions, without addresses. calls into pshmem_* and
+# shmem_* are the same entry point
+disasm() {
+  objdump -d --no-show-raw-insn "$1" |
+    awk -v fn="<$2>:" '$2 == fn { p = 1; next } p && /^$/ { exit } p' |
+    sed -e 's/^ *[0-9a-f]*:[[:space:]]*//' \
+        -e 's/[0-9a-f]* <\([^>+@]*\)[^>]*>/<\1>/' \
+        -e 's/<pshmem_/<shmem_/'
+}
+
+echo "== code"
+status=0
+for fn in bench_rma bench_amo; do
+  if diff <(disasm "$build/plain" $fn) <(disasm "$build/elided" $fn); then
+    echo "$fn: elided is identical to plain"
+  else
+    echo "$fn: elided differs from plain"
+    status=1
+  fi
+done
+exit $status
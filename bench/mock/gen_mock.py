@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Generates a pshmem.h and weak no-op pshmem_* stubs for every function
+include/shmem.h wraps, so the benchmarks can build on a machine without an
+OpenSHMEM installation. The declarations come from the wrapper's own function
+tables; mock.c supplies working versions of the functions the benchmarks
+actually call, the stubs cover the rest.
+
+usage: gen_mock.py OUTDIR"""
+import os
+import re
+import sys
+
+SHMEM_H = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                       '..', '..', 'include', 'shmem.h')
+
+PROLOGUE = '''// generated by bench/mock/gen_mock.py, single process stand-in for the
+// pshmem.h gen_pshmem.py would produce
+#ifndef _PSHMEM_MOCK_H
+#define _PSHMEM_MOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int shmem_team_t;
+typedef void *shmem_ctx_t;
+typedef struct {
+  int num_contexts;
+} shmem_team_config_t;
+
+#define SHMEM_TEAM_INVALID ((shmem_team_t)-1)
+#define SHMEM_TEAM_WORLD ((shmem_team_t)0)
+#define SHMEM_TEAM_SHARED ((shmem_team_t)1)
+#define SHMEM_CTX_DEFAULT ((shmem_ctx_t)0)
+
+enum {
+  SHMEM_THREAD_SINGLE,
+  SHMEM_THREAD_FUNNELED,
+  SHMEM_THREAD_SERIALIZED,
+  SHMEM_THREAD_MULTIPLE
+};
+enum {
+  SHMEM_CMP_EQ,
+  SHMEM_CMP_NE,
+  SHMEM_CMP_GT,
+  SHMEM_CMP_LE,
+  SHMEM_CMP_LT,
+  SHMEM_CMP_GE
+};
+#define SHMEM_SIGNAL_SET 0
+#define SHMEM_SIGNAL_ADD 1
+
+void pshmem_init(void);
+int pshmem_init_thread(int requested, int *provided);
+void pshmem_finalize(void);
+
+'''
+
+DECLS = '''
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX) \\
+  void p##FN_NAME DECL_ARGS;
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX) \\
+  RET_TYPE p##FN_NAME DECL_ARGS;
+_OSH_WRAPPED_FUNCTIONS
+#undef WRAP_CALL_VOID
+#undef WRAP_CALL_RET
+'''
+
+STUBS = '''// generated by bench/mock/gen_mock.py. weak, so mock.c can override them
+#include <string.h>
+
+#include "pshmem.h"
+
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+'''
+
+STUB_DEFS = '''
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX) \\
+  __attribute__((weak)) void p##FN_NAME DECL_ARGS {}
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX) \\
+  __attribute__((weak)) RET_TYPE p##FN_NAME DECL_ARGS { \\
+    RET_TYPE ret; \\
+    memset(&ret, 0, sizeof(ret)); \\
+    return ret; \\
+  }
+_OSH_WRAPPED_FUNCTIONS
+'''
+
+
+def function_tables(path):
+    """The type tables, helpers and _OSH_*_FUNCTIONS lists of shmem.h."""
+    s = open(path).read()
+    begin = s.index('// from osss-ucx')
+    end = s.index('\n\n', s.index('#define _OSH_WRAPPED_FUNCTIONS'))
+    return s[begin:end] + '\n'
+
+
+def undefs(tables):
+    """#undefs for every macro the tables define. shmem.h includes pshmem.h
+    and then defines them itself."""
+    names = sorted(set(re.findall(r'^\s*#\s*define\s+(\w+)', tables, re.M)))
+    return ''.join(f'#undef {name}\n' for name in names)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print(__doc__)
+        sys.exit(1)
+    out = sys.argv[1]
+    os.makedirs(out, exist_ok=True)
+    with open(os.path.join(out, 'pshmem.h'), 'w') as f:
+        tables = function_tables(SHMEM_H)
+        f.write(PROLOGUE + tables + DECLS + undefs(tables) + '\n#endif\n')
+    with open(os.path.join(out, 'pshmem_stubs.c'), 'w') as f:
+        f.write(STUBS + tables + STUB_DEFS)
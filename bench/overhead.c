@@ -0,0 +1,84 @@
+// ns per call of a few representative functions, for whatever OSH_TRACE_*
+// the environment sets. overhead.py runs it once per trace mode against the
+// mock backend and tabulates the results
+#define SHMEM_PERF_SETUP
+#include <shmem.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_PUT_ELEMS 4096
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// noinline so every call goes through the same call site, like a real loop
+__attribute__((noinline)) static void op_p(long *x, int pe, long n) {
+  for (long i = 0; i < n; i++) {
+    shmem_long_p(x, i, pe);
+  }
+}
+
+__attribute__((noinline)) static void op_put(double *dst, const double *src,
+                                             size_t elems, int pe, long n) {
+  for (long i = 0; i < n; i++) {
+    shmem_double_put(dst, src, elems, pe);
+  }
+}
+
+__attribute__((noinline)) static long op_fadd(long *x, int pe, long n) {
+  long sum = 0;
+  for (long i = 0; i < n; i++) {
+    sum += shmem_long_atomic_fetch_add(x, 1, pe);
+  }
+  return sum;
+}
+
+__attribute__((noinline)) static void op_barrier(long n) {
+  for (long i = 0; i < n; i++) {
+    shmem_barrier_all();
+  }
+}
+
+int main(int argc, char **argv) {
+  long iters = argc > 1 ? atol(argv[1]) : 200000;
+
+  shmem_init();
+  int pe = (shmem_my_pe() + 1) % shmem_n_pes();
+  long *x = (long *)shmem_malloc(sizeof(long));
+  double *dst = (double *)shmem_malloc(MAX_PUT_ELEMS * sizeof(double));
+  double *src = (double *)calloc(MAX_PUT_ELEMS, sizeof(double));
+  long sink = 0;
+
+  // every case runs a tenth of its iterations untimed first
+  double t;
+#define CASE(NAME, CALL)                                                       \
+  do {                                                                         \
+    long n = iters / 10;                                                       \
+    CALL;                                                                      \
+    n = iters;                                                                 \
+    t = now();                                                                 \
+    CALL;                                                                      \
+    t = now() - t;                                                             \
+    if (shmem_my_pe() == 0) {                                                  \
+      printf("%s %.1f\n", NAME, t * 1e9 / iters);                              \
+    }                                                                          \
+  } while (0)
+
+  CASE("shmem_long_p", op_p(x, pe, n));
+  CASE("shmem_double_put/1", op_put(dst, src, 1, pe, n));
+  CASE("shmem_double_put/64", op_put(dst, src, 64, pe, n));
+  CASE("shmem_double_put/4096", op_put(dst, src, MAX_PUT_ELEMS, pe, n));
+  CASE("shmem_long_atomic_fetch_add", sink += op_fadd(x, pe, n));
+  CASE("shmem_barrier_all", op_barrier(n));
+#undef CASE
+
+  free(src);
+  shmem_free(dst);
+  shmem_free(x);
+  shmem_finalize();
+  return sink == -1;
+}
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Measures what include/shmem.h costs per call. Builds overhead.c against
+the single-process mock backend in bench/mock, runs it once per trace mode
+and prints ns/call as a table, one row per function and one column per mode.
+
+`raw` is overhead.c with every function class compiled out of the wrapper,
+i.e. plain pshmem calls; the other columns are the normal build with the
+OSH_TRACE_* settings shown. Compare against a previous run to catch
+regressions in the _osh_log_call hot path.
+
+usage: overhead.py [--iters N] [--repeat N] [--cc CC]"""
+import argparse
+import os
+import shlex
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+INCLUDE = os.path.join(HERE, '..', 'include')
+ELIDE_ALL = ['-DOSH_TRACE_RMA=0', '-DOSH_TRACE_AMO=0',
+             '-DOSH_TRACE_COLLECTIVE=0', '-DOSH_TRACE_SYNC=0',
+             '-DOSH_TRACE_MEMORY=0', '-DOSH_TRACE_SETUP=0']
+
+# column name, binary, environment. the communication matrix is on by
+# default, it is turned off except in its own column so each mode is
+# measured on its own
+MODES = [
+    ('raw', 'raw', {'OSH_TRACE_MODE': 'off'}),
+    ('off', 'traced', {'OSH_TRACE_MODE': 'off'}),
+    ('comm', 'traced', {'OSH_TRACE_MODE': 'comm'}),
+    ('stats', 'traced', {'OSH_TRACE_MODE': 'stats', 'OSH_TRACE_COMM': '0'}),
+    ('bin', 'traced', {'OSH_TRACE_MODE': 'bin', 'OSH_TRACE_COMM': '0'}),
+    ('bin caller', 'traced', {'OSH_TRACE_MODE': 'bin', 'OSH_TRACE_COMM': '0',
+                              'OSH_TRACE_STACK': 'caller'}),
+    ('bin async', 'traced', {'OSH_TRACE_MODE': 'bin', 'OSH_TRACE_COMM': '0',
+                             'OSH_TRACE_ASYNC': '1'}),
+    ('bin mmap', 'traced', {'OSH_TRACE_MODE': 'bin', 'OSH_TRACE_COMM': '0',
+                            'OSH_TRACE_MMAP': '1'}),
+    ('sampled', 'traced', {'OSH_TRACE_MODE': 'bin', 'OSH_TRACE_COMM': '0',
+                           'OSH_TRACE_SAMPLE': '100'}),
+    ('csv', 'traced', {'OSH_TRACE_MODE': 'csv', 'OSH_TRACE_COMM': '0'}),
+    ('live', 'traced', {'OSH_TRACE_MODE': 'live', 'OSH_TRACE_COMM': '0'}),
+]
+
+
+def build(cc, out, extra):
+    mock = os.path.join(out, 'mock')
+    subprocess.run([sys.executable, os.path.join(HERE, 'mock', 'gen_mock.py'),
+                    mock], check=True)
+    for name, flags in (('raw', ELIDE_ALL), ('traced', [])):
+        cmd = (shlex.split(cc) + ['-std=gnu11', '-O2', '-g', '-I', INCLUDE,
+                                  '-I', mock] + flags + extra +
+               ['-o', os.path.join(out, name),
+                os.path.join(HERE, 'overhead.c'),
+                os.path.join(HERE, 'mock', 'mock.c'),
+                os.path.join(mock, 'pshmem_stubs.c'), '-lpthread'])
+        subprocess.run(cmd, check=True)
+
+
+def run(binary, env, iters, cwd):
+    full = {k: v for k, v in os.environ.items()
+            if not k.startswith('OSH_TRACE_')}
+    full.update(env)
+    out = subprocess.run([binary, str(iters)], env=full, cwd=cwd, check=True,
+                         stdout=subprocess.PIPE, universal_newlines=True)
+    results = {}
+    for line in out.stdout.splitlines():
+        name, ns = line.rsplit(' ', 1)
+        results[name] = float(ns)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--iters', type=int, default=200000,
+                        help='calls per function and mode')
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='runs per mode, the fastest one is reported')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'))
+    parser.add_argument('--cflags', default='',
+                        help='extra compiler flags for both builds')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        build(args.cc, tmp, shlex.split(args.cflags))
+        columns = []
+        for name, binary, env in MODES:
+            best = {}
+            for _ in range(args.repeat):
+                # each run gets a clean directory for its trace files
+                with tempfile.TemporaryDirectory(dir=tmp) as cwd:
+                    r = run(os.path.join(tmp, binary), env, args.iters, cwd)
+                for fn, ns in r.items():
+                    best[fn] = min(ns, best.get(fn, ns))
+            columns.append((name, best))
+
+    rows = list(columns[0][1])
+    width = max(len(r) for r in rows)
+    print('| ns/call'.ljust(width + 2) + ' | ' +
+          ' | '.join(f'{name:>10}' for name, _ in columns) + ' |')
+    print('|-' + '-' * width + '-+' +
+          '+'.join('-' * 12 for _ in columns) + '|')
+    for fn in rows:
+        print(f'| {fn:<{width}} | ' +
+              ' | '.join(f'{c.get(fn, float("nan")):>10.1f}'
+                         for _, c in columns) + ' |')
+
+
+if __name__ == "__main__":
+    main()
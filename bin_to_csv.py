@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+import glob
+import mmap
+import os
+import re
+import struct
+import sys
+
+BLOCK = struct.Struct('<HHiQ')
+HEADER = struct.Struct('<8sIIiiQdQQ64s')
+EVENT = struct.Struct('<QQQQIiII')
+TRAILER = struct.Struct('<QQQ')
+# struct _osh_clock_shift, after the header and the trailer since version 5
+CLOCK = struct.Struct('<qQQ')
+SEGMENTS = struct.Struct('<QQ')
+
+BLOCK_HEADER = 1
+BLOCK_FUNCS = 2
+BLOCK_STACKS = 3
+BLOCK_EVENTS = 4
+BLOCK_TRAILER = 5
+BLOCK_SEGMENTS = 7
+
+# calls that complete outstanding nbi operations, aux is how many they retired
+RETIRES_NBI = {'shmem_quiet', 'shmem_ctx_quiet', 'shmem_barrier_all',
+               'shmem_barrier'}
+# _osh_fn_collective: their aux is a sequence number per function and team,
+# the n-th call on every PE of the team being the same collective. one on a
+# team other than the world follows a collective_team event naming the team
+COLLECTIVE = re.compile(r'shmem_(barrier(_all)?|sync(_all)?|team_sync|'
+                        r'\w*?(broadcast|alltoalls?|f?collect|to_all|reduce)'
+                        r'(mem|32|64)?)$')
+
+
+def read_blocks(m, name, types):
+    """Blocks of the mapped trace m, with the payload of those in types.
+
+    In a mapped trace (OSH_TRACE_MMAP=1) the blocks after the segments block
+    sit in fixed size segments, one each. The rest of a segment is zeros, or
+    a record its thread had not finished."""
+    pos = 0
+    first = seg = 0
+    while pos + BLOCK.size <= len(m):
+        btype, tid, pe, size = BLOCK.unpack_from(m, pos)
+        if btype == 0:
+            if not seg:
+                return
+            pos = first if pos < first else first + ((pos - first) // seg + 1) * seg
+            continue
+        end = pos + BLOCK.size + size
+        if end > len(m):
+            print(f"warning: truncated block at end of {name}")
+            return
+        if btype == BLOCK_SEGMENTS:
+            first, seg = SEGMENTS.unpack_from(m, pos + BLOCK.size)
+        yield btype, tid, pe, m[pos + BLOCK.size:end] if btype in types else None
+        if seg and pos >= first:
+            end = first + ((pos - first) // seg + 1) * seg
+        pos = end
+
+
+def parse_stacks(payload):
+    off = 0
+    while off < len(payload):
+        stack_id, depth = struct.unpack_from('<II', payload, off)
+        off += 8
+        yield stack_id, struct.unpack_from(f'<{depth}Q', payload, off)
+        off += 8 * depth
+
+
+def format_stack(frames):
+    return ''.join(f"{hex(addr)}|" for addr in frames)
+
+
+def stack_table_name(filename):
+    # pperf.NNN.csv -> pstack.NNN.csv
+    head, tail = os.path.split(filename)
+    return os.path.join(head, 'pstack.' + tail.split('.', 1)[1])
+
+
+class PEState:
+    """Output and decoding state for one PE. A per-node trace interleaves the
+    blocks of several PEs, so each PE keeps its own.
+
+    Stack ids in the trace are per thread; they are renumbered into one table
+    for the PE, so pstack.NNN.csv looks the same with or without threads."""
+
+    def __init__(self, directory, pe):
+        self.out_name = os.path.join(directory, f"pperf.{pe:03d}.csv")
+        self.stacks_name = stack_table_name(self.out_name)
+        self.out = open(self.out_name, 'w')
+        self.stacks_out = open(self.stacks_name, 'w')
+        self.out.write("Time,Function,Duration_Sec,Target_PE,Bytes_RX,Bytes_TX,Thread,Stack_ID,Extra\n")
+        self.stacks_out.write("Stack_ID,Stacktrace\n")
+        self.origin = 0
+        self.sec_per_tick = 1e-9
+        self.init_extra = ''
+        # PE 0's Time minus ours: shift at `at` ns, changing by drift per ns
+        self.clock = [None, None]
+        self.shift = 0
+        self.shift_at = 0
+        self.drift = 0.0
+        self.funcs = []
+        self.collective = set()
+        # per thread, the team of the collective the next event may be
+        self.teams = {}
+        self.n_events = 0
+        self.n_stacks = 0
+        self.stack_ids = {}
+        self.complete = False
+
+    def align_clock(self):
+        """Shift and drift from the clock shifts of init and finalize."""
+        start, end = self.clock
+        if start is None or not start[2]:
+            return
+        self.shift, self.shift_at = start[0], start[1]
+        if end is not None and end[2] and end[1] > start[1]:
+            self.drift = (end[0] - start[0]) / (end[1] - start[1])
+
+    def time(self, start):
+        """Seconds on PE 0's timeline."""
+        ns = (start - self.origin) * self.sec_per_tick * 1e9
+        return (ns + self.shift + self.drift * (ns - self.shift_at)) / 1e9
+
+    def add_stack(self, tid, stack_id, frames):
+        self.stack_ids[(tid, stack_id)] = self.n_stacks
+        self.stacks_out.write(f"{self.n_stacks},{format_stack(frames)}\n")
+        self.n_stacks += 1
+
+    def close(self):
+        self.out.close()
+        self.stacks_out.close()
+        if not self.complete:
+            # the process died before finalize, a mapped trace still has
+            # every event up to that point
+            print(f"warning: {self.out_name} has no trailer, the run did not finish")
+        print(f"wrote {self.n_events} events to {self.out_name}, "
+              f"{self.n_stacks} stacks to {self.stacks_name}")
+
+
+def convert_file(filename):
+    pes = {}
+
+    with open(filename, 'rb') as f:
+        if os.fstat(f.fileno()).st_size == 0:
+            print(f"{filename} is empty")
+            return
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+            # stacks first: a mapped trace may have a thread's stacks after
+            # the events that use them
+            if read_meta(m, filename, pes):
+                read_events(m, filename, pes)
+
+    for st in pes.values():
+        st.close()
+
+
+def read_meta(m, filename, pes):
+    """Everything but the events. False if this isn't a trace at all."""
+    for btype, tid, pe, payload in read_blocks(
+            m, filename, (BLOCK_HEADER, BLOCK_FUNCS, BLOCK_STACKS, BLOCK_TRAILER)):
+        if pe not in pes:
+            pes[pe] = PEState(os.path.dirname(filename), pe)
+        st = pes[pe]
+        if btype == BLOCK_HEADER:
+            (magic, _, _, _, _, st.origin, ns_per_tick, _, slide,
+             host) = HEADER.unpack_from(payload)
+            if magic != b'OSHTRACE':
+                print(f"{filename} is not a trace file")
+                return False
+            st.sec_per_tick = ns_per_tick / 1e9
+            host = host.split(b'\0')[0].decode()
+            st.init_extra = f"host={host};slide={hex(slide)}"
+            if len(payload) >= HEADER.size + CLOCK.size:
+                st.clock[0] = CLOCK.unpack_from(payload, HEADER.size)
+        elif btype == BLOCK_FUNCS:
+            st.funcs = [n.decode() for n in payload.split(b'\0')[:-1]]
+            st.collective = {i for i, n in enumerate(st.funcs)
+                             if COLLECTIVE.match(n)}
+        elif btype == BLOCK_STACKS:
+            for stack_id, frames in parse_stacks(payload):
+                st.add_stack(tid, stack_id, frames)
+        elif btype == BLOCK_TRAILER:
+            _, dropped, _ = TRAILER.unpack_from(payload)
+            if len(payload) >= TRAILER.size + CLOCK.size:
+                st.clock[1] = CLOCK.unpack_from(payload, TRAILER.size)
+            if dropped:
+                print(f"warning: PE {pe} in {filename} dropped {dropped} events")
+            st.complete = True
+    for st in pes.values():
+        st.align_clock()
+    return True
+
+
+def read_events(m, filename, pes):
+    for btype, tid, pe, payload in read_blocks(m, filename, (BLOCK_EVENTS,)):
+        if btype != BLOCK_EVENTS:
+            continue
+        if pe not in pes:
+            pes[pe] = PEState(os.path.dirname(filename), pe)
+        st = pes[pe]
+        funcs = st.funcs
+        for (start, dur, rx, tx, func_id, target_pe, stack_id,
+             aux) in EVENT.iter_unpack(payload):
+            func = funcs[func_id] if func_id < len(funcs) else str(func_id)
+            team = st.teams.pop(tid, None)
+            if func == 'collective_team':
+                # start:stride:size, the stride signed
+                stride = rx - (1 << 64) if rx >= 1 << 63 else rx
+                st.teams[tid] = (aux, f"{target_pe}:{stride}:{tx}")
+                continue
+            extra = ''
+            if func in ('shmem_init', 'shmem_init_thread'):
+                extra = st.init_extra
+            elif func_id in st.collective:
+                extra = f"seq={aux}"
+                if team and team[0] == func_id:
+                    extra += f";team={team[1]}"
+            elif func in ('nbi_complete', 'heap_live'):
+                extra = funcs[aux] if aux < len(funcs) else str(aux)
+            elif aux and func in RETIRES_NBI:
+                extra = f"retired={aux}"
+            stack_id = st.stack_ids.get((tid, stack_id), -1)
+            st.out.write(f"{st.time(start):.9f},{func},"
+                         f"{dur * st.sec_per_tick:.9f},{target_pe},{rx},{tx},"
+                         f"{tid},{stack_id},{extra}\n")
+            st.n_events += 1
+
+
+if __name__ == "__main__":
+    files = sys.argv[1:] or sorted(glob.glob("pperf.*.bin"))
+    if not files:
+        print("no files matching pperf.*.bin found")
+    for f in files:
+        convert_file(f)
+    print("done")
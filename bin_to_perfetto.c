@@ -0,0 +1,879 @@
+// converts pperf.*.bin straight to the Perfetto (Chrome JSON) trace that
+// csv_to_perfetto.py builds from the csv files, for traces too big for it.
+// the files are mapped and every one is converted by its own thread, events
+// are streamed out as they are read so memory only grows with the number of
+// unique stacks
+//
+//   cc -O2 -pthread -o bin_to_perfetto bin_to_perfetto.c
+//   ./bin_to_perfetto [-o trace.json] [-j threads] [files...]
+//
+// without files it converts every pperf.*.bin in the current directory.
+// stack addresses are named from the psym.NNN.csv that
+// backtrace_of_stacktrace.py writes next to the trace, if there is one
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the on-disk layout, see struct _osh_block and friends in include/shmem.h
+enum {
+  BLOCK_HEADER = 1,
+  BLOCK_FUNCS = 2,
+  BLOCK_STACKS = 3,
+  BLOCK_EVENTS = 4,
+  BLOCK_TRAILER = 5,
+  BLOCK_SEGMENTS = 7,
+};
+
+struct block {
+  uint16_t type;
+  uint16_t tid;
+  int32_t pe;
+  uint64_t size;
+};
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t event_size;
+  int32_t pe;
+  int32_t n_pes;
+  uint64_t tick_origin;
+  double ns_per_tick;
+  uint64_t origin_ns;
+  uint64_t slide;
+  char host[64];
+};
+
+struct event {
+  uint64_t start;
+  uint64_t duration;
+  uint64_t bytes_rx;
+  uint64_t bytes_tx;
+  uint32_t func_id;
+  int32_t target_pe;
+  uint32_t stack_id;
+  uint32_t aux;
+};
+
+struct trailer {
+  uint64_t events;
+  uint64_t dropped;
+  uint64_t end_tick;
+};
+
+// follows the header and the trailer since version 5: PE 0's Time minus
+// this PE's, in ns, measured at `at`
+struct clock_shift {
+  int64_t shift;
+  uint64_t at;
+  uint64_t rtt; // 0 if not measured
+};
+
+// output is flushed once past OUT_BUFFER, a line never adds more than SLACK
+#define OUT_BUFFER (1 << 20)
+#define MAX_LINE 1024
+#define SLACK (4 * MAX_LINE)
+
+static void *xrealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (!p) {
+    perror("bin_to_perfetto");
+    exit(1);
+  }
+  return p;
+}
+
+static uint64_t hash64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  return x ^ (x >> 33);
+}
+
+static uint64_t hash_str(const char *s) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (; *s; s++) {
+    h = (h ^ (unsigned char)*s) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+// open addressing from a 64 bit key to a value, the key 0 is never stored
+struct map {
+  uint64_t *keys;
+  uint32_t *values;
+  uint32_t mask;
+  uint32_t count;
+};
+
+static uint32_t *map_slot(struct map *m, uint64_t key) {
+  if ((m->count + 1) * 4 > (m->mask + 1) * 3) {
+    struct map grown = {0};
+    grown.mask = m->mask ? m->mask * 2 + 1 : 1023;
+    grown.keys = (uint64_t *)calloc(grown.mask + 1, sizeof(uint64_t));
+    grown.values = (uint32_t *)xrealloc(NULL, (grown.mask + 1) *
+                                                  sizeof(uint32_t));
+    if (!grown.keys) {
+      perror("bin_to_perfetto");
+      exit(1);
+    }
+    for (uint32_t i = 0; m->mask && i <= m->mask; i++) {
+      if (m->keys[i]) {
+        *map_slot(&grown, m->keys[i]) = m->values[i];
+      }
+    }
+    free(m->keys);
+    free(m->values);
+    *m = grown;
+  }
+  for (uint32_t i = (uint32_t)hash64(key) & m->mask;; i = (i + 1) & m->mask) {
+    if (m->keys[i] == key) {
+      return &m->values[i];
+    }
+    if (m->keys[i] == 0) {
+      m->keys[i] = key;
+      m->values[i] = UINT32_MAX;
+      m->count++;
+      return &m->values[i];
+    }
+  }
+}
+
+static uint32_t map_get(const struct map *m, uint64_t key) {
+  if (!m->mask) {
+    return UINT32_MAX;
+  }
+  for (uint32_t i = (uint32_t)hash64(key) & m->mask;; i = (i + 1) & m->mask) {
+    if (m->keys[i] == key) {
+      return m->values[i];
+    }
+    if (m->keys[i] == 0) {
+      return UINT32_MAX;
+    }
+  }
+}
+
+static void map_free(struct map *m) {
+  free(m->keys);
+  free(m->values);
+  memset(m, 0, sizeof(*m));
+}
+
+// one PE's part of a file: per-node files hold several
+struct pe_state {
+  int32_t pe;
+  int has_header;
+  int has_trailer;
+  uint64_t origin;
+  double ns_per_tick;
+  struct clock_shift clock[2]; // from init and finalize
+  double drift;                // change of the shift per ns
+  char *funcs; // the funcs block, NUL separated
+  const char **func_names;
+  uint32_t n_funcs;
+  uint32_t heap_live;       // function id of the heap counter, n_funcs if none
+  uint32_t collective_team; // and of the team events
+  struct map symbol_ids; // address -> index into symbols, from psym.NNN.csv
+  char **symbols;        // inline chains, innermost first and '|' separated
+  uint32_t n_symbols;
+};
+
+// a stack as the trace interned it, ids are per PE and thread
+struct stack {
+  uint32_t pe; // index into file.pes
+  uint32_t first_frame; // into file.frames
+  uint32_t depth;
+  uint32_t leaf; // stackFrames id of the innermost frame, 0 if none
+};
+
+struct file {
+  const char *name;
+  int valid; // has a trace header
+  const char *base;
+  uint64_t len;
+  struct pe_state *pes;
+  uint32_t n_pes;
+  struct stack *stacks;
+  uint32_t n_stacks;
+  uint64_t *frames;
+  uint32_t n_frames;
+  struct map stack_ids; // (pe, tid, id) -> index into stacks
+  FILE *out;            // its events, copied into the trace at the end
+  uint64_t n_events;
+};
+
+static uint64_t stack_key(int32_t pe, uint16_t tid, uint32_t id) {
+  // stack ids are dense per thread, so this only collides for absurd traces
+  return ((uint64_t)(uint32_t)pe << 44 ^ (uint64_t)tid << 32 ^ id) + 1;
+}
+
+static struct pe_state *pe_state(struct file *f, int32_t pe) {
+  for (uint32_t i = 0; i < f->n_pes; i++) {
+    if (f->pes[i].pe == pe) {
+      return &f->pes[i];
+    }
+  }
+  f->pes = (struct pe_state *)xrealloc(f->pes, (f->n_pes + 1) *
+                                                   sizeof(struct pe_state));
+  struct pe_state *p = &f->pes[f->n_pes++];
+  memset(p, 0, sizeof(*p));
+  p->pe = pe;
+  p->ns_per_tick = 1.0;
+  return p;
+}
+
+// walks the blocks of a file, following the segments of a mapped trace:
+// one block each, what follows it up to the next segment is unused
+struct cursor {
+  const struct file *f;
+  uint64_t pos;
+  uint64_t first;
+  uint64_t segment;
+};
+
+static const char *next_block(struct cursor *c, struct block *b) {
+  const struct file *f = c->f;
+  while (c->pos + sizeof(*b) <= f->len) {
+    memcpy(b, f->base + c->pos, sizeof(*b));
+    if (b->type == 0) {
+      if (!c->segment) {
+        return NULL;
+      }
+      c->pos = c->pos < c->first
+                   ? c->first
+                   : c->first +
+                         ((c->pos - c->first) / c->segment + 1) * c->segment;
+      continue;
+    }
+    const char *payload = f->base + c->pos + sizeof(*b);
+    if (b->size > f->len - c->pos - sizeof(*b)) {
+      fprintf(stderr, "warning: truncated block at end of %s\n", f->name);
+      return NULL;
+    }
+    if (c->segment && c->pos >= c->first) {
+      c->pos = c->first +
+               ((c->pos - c->first) / c->segment + 1) * c->segment;
+    } else {
+      c->pos += sizeof(*b) + b->size;
+    }
+    if (b->type == BLOCK_SEGMENTS && b->size >= 2 * sizeof(uint64_t)) {
+      memcpy(&c->first, payload, sizeof(uint64_t));
+      memcpy(&c->segment, payload + sizeof(uint64_t), sizeof(uint64_t));
+    }
+    return payload;
+  }
+  return NULL;
+}
+
+// first pass over a file: headers, function names and stacks. a mapped
+// trace can have a thread's stacks after the events that use them
+static void read_meta(struct file *f) {
+  struct cursor c = {f, 0, 0, 0};
+  struct block b;
+  const char *payload;
+  while ((payload = next_block(&c, &b))) {
+    struct pe_state *p = pe_state(f, b.pe);
+    if (b.type == BLOCK_HEADER && b.size >= sizeof(struct header)) {
+      struct header h;
+      memcpy(&h, payload, sizeof(h));
+      if (memcmp(h.magic, "OSHTRACE", 8) != 0) {
+        fprintf(stderr, "%s is not a trace file\n", f->name);
+        f->valid = 0;
+        f->n_pes = 0;
+        return;
+      }
+      f->valid = 1;
+      p->has_header = 1;
+      p->origin = h.tick_origin;
+      p->ns_per_tick = h.ns_per_tick;
+      if (b.size >= sizeof(h) + sizeof(struct clock_shift)) {
+        memcpy(&p->clock[0], payload + sizeof(h), sizeof(struct clock_shift));
+      }
+    } else if (b.type == BLOCK_FUNCS) {
+      free(p->funcs);
+      p->funcs = (char *)xrealloc(NULL, b.size + 1);
+      memcpy(p->funcs, payload, b.size);
+      p->funcs[b.size] = '\0';
+      p->n_funcs = 0;
+      for (uint64_t i = 0; i < b.size; i += strlen(p->funcs + i) + 1) {
+        p->func_names = (const char **)xrealloc(
+            p->func_names, (p->n_funcs + 1) * sizeof(char *));
+        p->func_names[p->n_funcs++] = p->funcs + i;
+      }
+      p->heap_live = p->collective_team = p->n_funcs;
+      for (uint32_t i = 0; i < p->n_funcs; i++) {
+        if (strcmp(p->func_names[i], "heap_live") == 0) {
+          p->heap_live = i;
+        } else if (strcmp(p->func_names[i], "collective_team") == 0) {
+          p->collective_team = i;
+        }
+      }
+    } else if (b.type == BLOCK_STACKS) {
+      for (uint64_t off = 0; off + sizeof(uint64_t) <= b.size;) {
+        uint32_t word[2];
+        memcpy(word, payload + off, sizeof(word));
+        off += sizeof(word);
+        uint32_t depth = word[1];
+        if (off + depth * sizeof(uint64_t) > b.size) {
+          break;
+        }
+        f->stacks = (struct stack *)xrealloc(
+            f->stacks, (f->n_stacks + 1) * sizeof(struct stack));
+        f->frames = (uint64_t *)xrealloc(
+            f->frames, (f->n_frames + depth) * sizeof(uint64_t));
+        struct stack *s = &f->stacks[f->n_stacks];
+        s->pe = (uint32_t)(p - f->pes);
+        s->first_frame = f->n_frames;
+        s->depth = depth;
+        s->leaf = 0;
+        memcpy(f->frames + f->n_frames, payload + off,
+               depth * sizeof(uint64_t));
+        f->n_frames += depth;
+        off += depth * sizeof(uint64_t);
+        *map_slot(&f->stack_ids, stack_key(b.pe, b.tid, word[0])) =
+            f->n_stacks++;
+      }
+    } else if (b.type == BLOCK_TRAILER && b.size >= sizeof(struct trailer)) {
+      struct trailer t;
+      memcpy(&t, payload, sizeof(t));
+      p->has_trailer = 1;
+      if (b.size >= sizeof(t) + sizeof(struct clock_shift)) {
+        memcpy(&p->clock[1], payload + sizeof(t), sizeof(struct clock_shift));
+      }
+      if (t.dropped) {
+        fprintf(stderr, "warning: PE %d in %s dropped %llu events\n", b.pe,
+                f->name, (unsigned long long)t.dropped);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < f->n_pes; i++) {
+    struct pe_state *p = &f->pes[i];
+    if (!p->clock[0].rtt) {
+      memset(p->clock, 0, sizeof(p->clock));
+    } else if (p->clock[1].rtt && p->clock[1].at > p->clock[0].at) {
+      p->drift = (double)(p->clock[1].shift - p->clock[0].shift) /
+                 (double)(p->clock[1].at - p->clock[0].at);
+    }
+    if (!f->pes[i].has_trailer) {
+      fprintf(stderr, "warning: PE %d in %s has no trailer, the run did not "
+                      "finish\n",
+              f->pes[i].pe, f->name);
+    }
+  }
+}
+
+// stackFrames, shared by all files: a frame is its name and its parent, so
+// stacks with the same outer frames share them (csv_to_perfetto's
+// frame_cache)
+struct frames {
+  struct map ids; // hash of (name, parent) -> index
+  char **names;
+  uint32_t *parents;
+  uint32_t count;
+};
+
+static struct frames frames;
+
+// frame id for name under parent, 1 based like csv_to_perfetto.py
+static uint32_t frame_id(const char *name, uint32_t parent) {
+  uint64_t key = hash_str(name) ^ hash64(parent);
+  // a different frame with the same hash moves on to the next key
+  for (;; key++) {
+    if (!key) {
+      continue;
+    }
+    uint32_t *slot = map_slot(&frames.ids, key);
+    if (*slot == UINT32_MAX) {
+      frames.names =
+          (char **)xrealloc(frames.names, (frames.count + 1) * sizeof(char *));
+      frames.parents = (uint32_t *)xrealloc(
+          frames.parents, (frames.count + 1) * sizeof(uint32_t));
+      frames.names[frames.count] = strdup(name);
+      frames.parents[frames.count] = parent;
+      *slot = frames.count++;
+      return *slot + 1;
+    }
+    if (frames.parents[*slot] == parent &&
+        strcmp(frames.names[*slot], name) == 0) {
+      return *slot + 1;
+    }
+  }
+}
+
+// one field of a csv line, unquoted into out. returns the rest of the line
+static char *csv_field(char *line, char *out, size_t size) {
+  size_t n = 0;
+  int quoted = *line == '"';
+  line += quoted;
+  for (; *line && *line != '\n' && *line != '\r'; line++) {
+    if (quoted && *line == '"') {
+      if (line[1] != '"') {
+        quoted = 0;
+        continue;
+      }
+      line++;
+    } else if (!quoted && *line == ',') {
+      line++;
+      break;
+    }
+    if (n + 1 < size) {
+      out[n++] = *line;
+    }
+  }
+  out[n] = '\0';
+  return line;
+}
+
+// psym.NNN.csv of every PE in the file: Address,Module,Offset,Symbol
+static void load_symbols(struct file *f) {
+  const char *slash = strrchr(f->name, '/');
+  int dir = slash ? (int)(slash - f->name + 1) : 0;
+  char *line = NULL;
+  size_t cap = 0;
+  char address[64], symbol[4 * MAX_LINE];
+  for (uint32_t i = 0; i < f->n_pes; i++) {
+    struct pe_state *p = &f->pes[i];
+    char path[4096];
+    snprintf(path, sizeof(path), "%.*spsym.%03d.csv", dir, f->name, p->pe);
+    FILE *in = fopen(path, "r");
+    if (!in) {
+      continue;
+    }
+    // the first line is the column names
+    for (int first = 1; getline(&line, &cap, in) != -1; first = 0) {
+      char *rest = csv_field(line, address, sizeof(address));
+      for (int col = 1; col <= 3; col++) {
+        rest = csv_field(rest, symbol, sizeof(symbol));
+      }
+      if (first || !*symbol) {
+        continue;
+      }
+      uint64_t addr = strtoull(address, NULL, 16);
+      uint32_t *slot = map_slot(&p->symbol_ids, addr + 1);
+      if (*slot == UINT32_MAX) {
+        p->symbols = (char **)xrealloc(p->symbols, (p->n_symbols + 1) *
+                                                       sizeof(char *));
+        p->symbols[p->n_symbols] = strdup(symbol);
+        *slot = p->n_symbols++;
+      }
+    }
+    fclose(in);
+  }
+  free(line);
+}
+
+// the stackFrames ids of every stack's innermost frame, outermost first. an
+// address with symbols becomes one frame per inlined function. wrapper
+// internals are left out, as csv_to_perfetto.py does
+static void build_frames(struct file *f) {
+  char name[MAX_LINE];
+  for (uint32_t s = 0; s < f->n_stacks; s++) {
+    struct stack *st = &f->stacks[s];
+    struct pe_state *p = &f->pes[st->pe];
+    uint32_t parent = 0;
+    for (uint32_t d = st->depth; d-- > 0;) {
+      uint64_t addr = f->frames[st->first_frame + d];
+      uint32_t id = map_get(&p->symbol_ids, addr + 1);
+      if (id == UINT32_MAX) {
+        snprintf(name, sizeof(name), "0x%llx", (unsigned long long)addr);
+        parent = frame_id(name, parent);
+        continue;
+      }
+      const char *chain = p->symbols[id];
+      for (const char *end = chain + strlen(chain); end > chain;) {
+        const char *start = end;
+        while (start > chain && start[-1] != '|') {
+          start--;
+        }
+        snprintf(name, sizeof(name), "%.*s", (int)(end - start), start);
+        end = start > chain ? start - 1 : chain;
+        if (*name && strncmp(name, "_osh_", 5) != 0) {
+          parent = frame_id(name, parent);
+        }
+      }
+    }
+    st->leaf = parent;
+  }
+}
+
+// output is formatted by hand, printf would dominate the conversion
+struct out {
+  FILE *f;
+  char *buf;
+  size_t len;
+};
+
+static void out_flush(struct out *o) {
+  fwrite(o->buf, 1, o->len, o->f);
+  o->len = 0;
+}
+
+static void out_str(struct out *o, const char *s) {
+  size_t len = strlen(s);
+  memcpy(o->buf + o->len, s, len);
+  o->len += len;
+}
+
+static void out_u64(struct out *o, uint64_t v) {
+  char tmp[20];
+  int n = 0;
+  do {
+    tmp[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v);
+  while (n) {
+    o->buf[o->len++] = tmp[--n];
+  }
+}
+
+static void out_i64(struct out *o, int64_t v) {
+  if (v < 0) {
+    o->buf[o->len++] = '-';
+    out_u64(o, -(uint64_t)v);
+  } else {
+    out_u64(o, (uint64_t)v);
+  }
+}
+
+// ns as µs with three decimals
+static void out_us(struct out *o, int64_t ns) {
+  uint64_t abs = ns < 0 ? -(uint64_t)ns : (uint64_t)ns;
+  if (ns < 0) {
+    o->buf[o->len++] = '-';
+  }
+  out_u64(o, abs / 1000);
+  uint64_t frac = abs % 1000;
+  o->buf[o->len++] = '.';
+  o->buf[o->len++] = (char)('0' + frac / 100);
+  o->buf[o->len++] = (char)('0' + frac / 10 % 10);
+  o->buf[o->len++] = (char)('0' + frac % 10);
+}
+
+// JSON string contents, truncated to what fits in a line
+static void out_json(struct out *o, const char *s) {
+  for (size_t n = 0; *s && n < MAX_LINE; s++, n++) {
+    unsigned char ch = (unsigned char)*s;
+    if (ch == '"' || ch == '\\') {
+      o->buf[o->len++] = '\\';
+      o->buf[o->len++] = (char)ch;
+    } else if (ch >= 0x20) {
+      o->buf[o->len++] = (char)ch;
+    }
+  }
+}
+
+// second pass: every event, one JSON object per line into f->out
+static void write_events(struct file *f) {
+  if (!f->valid) {
+    return;
+  }
+  struct out o = {f->out, (char *)xrealloc(NULL, OUT_BUFFER + SLACK), 0};
+  struct cursor c = {f, 0, 0, 0};
+  struct block b;
+  const char *payload;
+  while ((payload = next_block(&c, &b))) {
+    if (b.type != BLOCK_EVENTS) {
+      continue;
+    }
+    struct pe_state *p = pe_state(f, b.pe);
+    uint64_t n = b.size / sizeof(struct event);
+    for (uint64_t i = 0; i < n; i++) {
+      struct event ev;
+      memcpy(&ev, payload + i * sizeof(ev), sizeof(ev));
+      if (ev.func_id == p->collective_team) {
+        // only names the team of the collective after it
+        continue;
+      }
+      // on PE 0's timeline
+      double ns = (double)(int64_t)(ev.start - p->origin) * p->ns_per_tick;
+      int64_t ts = (int64_t)(ns + (double)p->clock[0].shift +
+                             p->drift * (ns - (double)p->clock[0].at));
+      if (ev.func_id == p->heap_live) {
+        // a counter track per PE: live bytes and the high-water mark
+        out_str(&o, ",{\"name\":\"symmetric heap\",\"ph\":\"C\",\"ts\":");
+        out_us(&o, ts);
+        out_str(&o, ",\"pid\":");
+        out_i64(&o, b.pe);
+        out_str(&o, ",\"args\":{\"live\":");
+        out_u64(&o, ev.bytes_tx);
+        out_str(&o, ",\"peak\":");
+        out_u64(&o, ev.bytes_rx);
+        out_str(&o, "}}\n");
+        if (o.len > OUT_BUFFER) {
+          out_flush(&o);
+        }
+        continue;
+      }
+      out_str(&o, ",{\"name\":\"");
+      if (ev.func_id < p->n_funcs) {
+        out_json(&o, p->func_names[ev.func_id]);
+      } else {
+        out_u64(&o, ev.func_id);
+      }
+      out_str(&o, "\",\"cat\":\"PERF\",\"ph\":\"X\",\"ts\":");
+      out_us(&o, ts);
+      out_str(&o, ",\"dur\":");
+      out_us(&o, (int64_t)((double)ev.duration * p->ns_per_tick));
+      out_str(&o, ",\"pid\":");
+      out_i64(&o, b.pe);
+      out_str(&o, ",\"tid\":");
+      out_u64(&o, b.tid + 1u);
+      out_str(&o, ",\"args\":{\"target_pe\":");
+      out_i64(&o, ev.target_pe);
+      out_str(&o, ",\"bytes_rx\":");
+      out_u64(&o, ev.bytes_rx);
+      out_str(&o, ",\"bytes_tx\":");
+      out_u64(&o, ev.bytes_tx);
+      if (ev.target_pe != -1) {
+        out_str(&o, ",\"msg\":\"To PE ");
+        out_i64(&o, ev.target_pe);
+        out_str(&o, "\"");
+      }
+      out_str(&o, "}");
+      uint32_t s = map_get(&f->stack_ids, stack_key(b.pe, b.tid, ev.stack_id));
+      if (s != UINT32_MAX && f->stacks[s].leaf) {
+        out_str(&o, ",\"sf\":");
+        out_u64(&o, f->stacks[s].leaf);
+      }
+      out_str(&o, "}\n");
+      if (o.len > OUT_BUFFER) {
+        out_flush(&o);
+      }
+    }
+    f->n_events += n;
+  }
+  out_flush(&o);
+  free(o.buf);
+}
+
+// files are handed to the threads one at a time
+struct pool {
+  struct file *files;
+  int n_files;
+  int next;
+  void (*fn)(struct file *);
+};
+
+static void *worker(void *arg) {
+  struct pool *pool = (struct pool *)arg;
+  for (;;) {
+    int i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    if (i >= pool->n_files) {
+      return NULL;
+    }
+    pool->fn(&pool->files[i]);
+  }
+}
+
+static void run_pool(struct file *files, int n_files, int n_threads,
+                     void (*fn)(struct file *)) {
+  struct pool pool = {files, n_files, 0, fn};
+  if (n_threads > n_files) {
+    n_threads = n_files;
+  }
+  pthread_t *threads = (pthread_t *)calloc(n_threads, sizeof(pthread_t));
+  for (int i = 0; i < n_threads; i++) {
+    pthread_create(&threads[i], NULL, worker, &pool);
+  }
+  for (int i = 0; i < n_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+}
+
+static int open_file(struct file *f, const char *name) {
+  memset(f, 0, sizeof(*f));
+  f->name = name;
+  int fd = open(name, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    perror(name);
+    if (fd != -1) {
+      close(fd);
+    }
+    return -1;
+  }
+  f->len = (uint64_t)st.st_size;
+  if (f->len) {
+    void *base = mmap(NULL, f->len, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+      perror(name);
+      close(fd);
+      return -1;
+    }
+    madvise(base, f->len, MADV_SEQUENTIAL);
+    f->base = (const char *)base;
+  }
+  close(fd);
+  f->out = tmpfile();
+  if (!f->out) {
+    perror("bin_to_perfetto");
+    return -1;
+  }
+  return 0;
+}
+
+static void close_file(struct file *f) {
+  if (f->base) {
+    munmap((void *)f->base, f->len);
+  }
+  for (uint32_t i = 0; i < f->n_pes; i++) {
+    free(f->pes[i].funcs);
+    free(f->pes[i].func_names);
+    for (uint32_t j = 0; j < f->pes[i].n_symbols; j++) {
+      free(f->pes[i].symbols[j]);
+    }
+    free(f->pes[i].symbols);
+    map_free(&f->pes[i].symbol_ids);
+  }
+  free(f->pes);
+  free(f->stacks);
+  free(f->frames);
+  map_free(&f->stack_ids);
+  if (f->out) {
+    fclose(f->out);
+  }
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: bin_to_perfetto [-o trace.json] [-j threads] "
+                  "[pperf.*.bin...]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *output = "trace.json";
+  long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+  while ((opt = getopt(argc, argv, "o:j:h")) != -1) {
+    switch (opt) {
+    case 'o':
+      output = optarg;
+      break;
+    case 'j':
+      n_threads = atol(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (n_threads < 1) {
+    n_threads = 1;
+  }
+
+  glob_t g = {0};
+  char **names = argv + optind;
+  int n_files = argc - optind;
+  if (!n_files) {
+    if (glob("pperf.*.bin", 0, NULL, &g) != 0) {
+      printf("no files matching pperf.*.bin found\n");
+      return 1;
+    }
+    names = g.gl_pathv;
+    n_files = (int)g.gl_pathc;
+  }
+
+  struct file *files = (struct file *)calloc(n_files, sizeof(struct file));
+  int n_open = 0;
+  for (int i = 0; i < n_files; i++) {
+    if (open_file(&files[n_open], names[i]) == 0) {
+      n_open++;
+    } else {
+      close_file(&files[n_open]);
+    }
+  }
+  printf("converting %d files...\n", n_open);
+
+  run_pool(files, n_open, (int)n_threads, read_meta);
+  run_pool(files, n_open, (int)n_threads, load_symbols);
+  uint32_t n_symbols = 0;
+  for (int i = 0; i < n_open; i++) {
+    build_frames(&files[i]);
+    for (uint32_t p = 0; p < files[i].n_pes; p++) {
+      n_symbols += files[i].pes[p].n_symbols;
+    }
+  }
+  run_pool(files, n_open, (int)n_threads, write_events);
+
+  FILE *out = fopen(output, "w");
+  if (!out) {
+    perror(output);
+    return 1;
+  }
+  struct out o = {out, (char *)xrealloc(NULL, OUT_BUFFER + SLACK), 0};
+  // the process names come first, so every event can start with a comma
+  out_str(&o, "{\"traceEvents\":[\n");
+  int first = 1;
+  for (int i = 0; i < n_open; i++) {
+    for (uint32_t p = 0; p < files[i].n_pes; p++) {
+      out_str(&o, first ? "{" : ",{");
+      out_str(&o, "\"name\":\"process_name\",\"ph\":\"M\",\"pid\":");
+      out_i64(&o, files[i].pes[p].pe);
+      out_str(&o, ",\"args\":{\"name\":\"PE ");
+      out_i64(&o, files[i].pes[p].pe);
+      out_str(&o, "\"}}\n");
+      first = 0;
+    }
+  }
+  out_flush(&o);
+
+  uint64_t n_events = 0;
+  for (int i = 0; i < n_open; i++) {
+    struct file *f = &files[i];
+    fflush(f->out);
+    rewind(f->out);
+    size_t n;
+    while ((n = fread(o.buf, 1, OUT_BUFFER, f->out)) > 0) {
+      fwrite(o.buf, 1, n, out);
+    }
+    n_events += f->n_events;
+  }
+
+  out_str(&o, "],\"stackFrames\":{");
+  for (uint32_t i = 0; i < frames.count; i++) {
+    out_str(&o, i ? ",\n\"" : "\n\"");
+    out_u64(&o, i + 1);
+    out_str(&o, "\":{\"name\":\"");
+    out_json(&o, frames.names[i]);
+    out_str(&o, "\"");
+    if (frames.parents[i]) {
+      out_str(&o, ",\"parent\":");
+      out_u64(&o, frames.parents[i]);
+    }
+    out_str(&o, "}");
+    if (o.len > OUT_BUFFER) {
+      out_flush(&o);
+    }
+  }
+  out_str(&o, "}}\n");
+  out_flush(&o);
+  free(o.buf);
+  if (fclose(out) != 0) {
+    perror(output);
+    return 1;
+  }
+
+  printf("wrote %llu events to %s\n", (unsigned long long)n_events, output);
+  if (n_symbols) {
+    printf("symbols from psym.*.csv: %u addresses\n", n_symbols);
+  } else {
+    printf("no psym.*.csv, run backtrace_of_stacktrace.py first. enjoy "
+           "offsets!\n");
+  }
+
+  for (int i = 0; i < n_open; i++) {
+    close_file(&files[i]);
+  }
+  free(files);
+  globfree(&g);
+  return 0;
+}
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""Load imbalance at collectives. Every barrier, broadcast, reduction,
+alltoall and collect carries a sequence number per function and team (`seq=`
+in Extra, with `team=start:stride:size` unless the team is the world), so
+the n-th shmem_barrier_all of one PE is matched with the n-th of every other
+PE, and the n-th reduction on a team with the n-th of the team's other PEs,
+and their arrival times compared. Time is on PE 0's clock
+(see the README), so this holds across hosts.
+
+For each collective the last PE to arrive is the one everybody waited for.
+Its compute interval is the time since it left its previous collective,
+less what it spent in other shmem calls in between. Summed over the run
+these give the critical path: last arrivers' compute, their shmem calls and
+the collectives themselves, against the skew the other PEs sat out.
+
+Reads pperf.*.csv (bin_to_csv.py output or OSH_TRACE_MODE=csv), writes one
+row per collective to pskew.csv and prints the totals.
+
+usage: collective_skew.py [--top N] [pperf.*.csv...]"""
+import argparse
+import csv
+import glob
+import os
+
+from csv_to_perfetto import clock_alignment, parse_clock
+
+# synthetic or outside the program's phases, never part of an interval
+NOT_SHMEM_TIME = {'nbi_complete', 'shmem_init', 'shmem_init_thread',
+                  'shmem_finalize'}
+
+
+class Arrival:
+    __slots__ = ('time', 'duration', 'compute', 'shmem')
+
+    def __init__(self, time, duration, compute, shmem):
+        self.time = time
+        self.duration = duration
+        self.compute = compute  # None for a PE's first collective
+        self.shmem = shmem
+
+
+def collective_of(extra):
+    """(team, seq) from a collective's Extra, None for any other call and
+    for a collective on a team that wasn't valid."""
+    fields = dict(p.split('=', 1) for p in extra.split(';') if '=' in p)
+    seq = fields.get('seq')
+    if seq is None or seq == '0':
+        return None
+    return fields.get('team', 'world'), int(seq)
+
+
+def read_pe(filename):
+    """(function, team, seq) -> Arrival for one PE's trace."""
+    rows = []
+    init_end = init_tid = None
+    clock = [None, None]
+    with open(filename, 'r') as f:
+        for row in csv.DictReader(f):
+            func = row['Function']
+            time, duration = float(row['Time']), float(row['Duration_Sec'])
+            extra = row.get('Extra') or ''
+            seq = collective_of(extra)
+            tid = row.get('Thread') or '0'
+            if func in ('shmem_init', 'shmem_init_thread'):
+                init_end, init_tid = time + duration, tid
+                clock[0] = parse_clock(extra)
+            elif func == 'shmem_finalize':
+                clock[1] = parse_clock(extra)
+            rows.append((time, duration, tid, func, seq))
+    # a csv trace is still on the PE's own clock
+    shift, at, drift = clock_alignment(*clock)
+    if shift or drift:
+        def aligned(sec):
+            ns = sec * 1e9
+            return (ns + shift + drift * (ns - at)) / 1e9
+        rows = [(aligned(r[0]),) + r[1:] for r in rows]
+        init_end = aligned(init_end) if init_end is not None else None
+    # threads' blocks interleave in the file
+    rows.sort(key=lambda r: r[0])
+
+    # per thread: when its last collective ended, shmem time since then
+    last_exit = {}
+    shmem = {}
+    arrivals = {}
+    for time, duration, tid, func, seq in rows:
+        if seq is None:
+            if func not in NOT_SHMEM_TIME:
+                shmem[tid] = shmem.get(tid, 0.0) + duration
+            continue
+        prev = last_exit.get(tid, init_end if tid == init_tid else None)
+        busy = shmem.pop(tid, 0.0)
+        compute = time - prev - busy if prev is not None else None
+        arrivals[(func,) + seq] = Arrival(time, duration, compute, busy)
+        last_exit[tid] = time + duration
+    return arrivals
+
+
+def pe_of(filename):
+    try:
+        return int(os.path.basename(filename).split('.')[1])
+    except (IndexError, ValueError):
+        return 0
+
+
+def fmt(sec):
+    return f"{sec:.6f}" if sec is not None else ''
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--top', type=int, default=10,
+                        help='functions and PEs to list')
+    parser.add_argument('files', nargs='*')
+    args = parser.parse_args()
+
+    files = args.files or sorted(glob.glob("pperf.*.csv"))
+    if not files:
+        print("no files matching pperf.*.csv found")
+        return
+    pes = {pe_of(f): read_pe(f) for f in files}
+    n_pes = len(pes)
+
+    # every collective seen on at least two PEs, in order of first arrival
+    by_key = {}
+    for pe, arrivals in pes.items():
+        for key, a in arrivals.items():
+            by_key.setdefault(key, {})[pe] = a
+    instances = sorted((min(a.time for a in seen.values()), key, seen)
+                       for key, seen in by_key.items() if len(seen) > 1)
+    if not instances:
+        print("no collective was seen on more than one PE. traces from "
+              "before collectives carried a seq= are not supported")
+        return
+
+    partial = 0
+    crit_compute = crit_shmem = crit_coll = 0.0
+    skew_total = waited_total = 0.0
+    funcs = {}
+    last_pes = {}
+    with open("pskew.csv", 'w', newline='') as f:
+        w = csv.writer(f)
+        w.writerow(['Function', 'Team', 'Seq', 'PEs', 'First_Arrival',
+                    'Last_Arrival', 'Skew_Sec', 'Last_PE',
+                    'Last_PE_Compute_Sec', 'Last_PE_Shmem_Sec',
+                    'Last_PE_Duration_Sec'])
+        for first, (func, team, seq), seen in instances:
+            last_pe, last = max(seen.items(), key=lambda kv: kv[1].time)
+            skew = last.time - first
+            size = n_pes if team == 'world' else int(team.split(':')[2])
+            partial += len(seen) < size
+            skew_total += skew
+            waited_total += sum(last.time - a.time for a in seen.values())
+            crit_compute += last.compute or 0.0
+            crit_shmem += last.shmem
+            crit_coll += last.duration
+
+            st = funcs.setdefault(func, [0, 0.0, 0.0])
+            st[0] += 1
+            st[1] += skew
+            st[2] = max(st[2], skew)
+            lp = last_pes.setdefault(last_pe, [0, 0.0])
+            lp[0] += 1
+            lp[1] += skew
+            w.writerow([func, team, seq, len(seen), fmt(first),
+                        fmt(last.time), fmt(skew), last_pe, fmt(last.compute),
+                        fmt(last.shmem), fmt(last.duration)])
+
+    # from where the first critical interval begins
+    first, _, seen = instances[0]
+    last = max(seen.values(), key=lambda a: a.time)
+    start = min(first, last.time - (last.compute or 0.0) - last.shmem)
+    end = max(a.time + a.duration for a in instances[-1][2].values())
+    wall = end - start
+    crit = crit_compute + crit_shmem + crit_coll
+
+    def share(sec):
+        return f"{sec:12.6f} s {100 * sec / wall if wall > 0 else 0:5.1f}%"
+
+    print(f"{len(instances)} collectives matched across {n_pes} PEs"
+          + (f", {partial} seen on fewer PEs" if partial else ''))
+    print(f"up to the last collective    {share(wall)}")
+    print(f"critical path                {share(crit)}")
+    print(f"  last arrivers' compute     {share(crit_compute)}")
+    print(f"  last arrivers' shmem calls {share(crit_shmem)}")
+    print(f"  collectives                {share(crit_coll)}")
+    print(f"arrival skew                 {share(skew_total)}")
+    print(f"PE-seconds spent waiting     {waited_total:12.6f}")
+    print(f"wrote {len(instances)} rows to pskew.csv")
+
+    print()
+    width = max(len(fn) for fn in funcs)
+    print(f"{'function':<{width}} {'count':>8} {'skew s':>12} {'mean s':>12} "
+          f"{'max s':>12}")
+    for fn, (count, total, worst) in sorted(funcs.items(),
+                                            key=lambda kv: -kv[1][1])[:args.top]:
+        print(f"{fn:<{width}} {count:>8} {total:12.6f} {total / count:12.6f} "
+              f"{worst:12.6f}")
+
+    print()
+    print(f"{'last PE':>8} {'times':>8} {'skew s':>12}")
+    for pe, (count, total) in sorted(last_pes.items(),
+                                     key=lambda kv: -kv[1][1])[:args.top]:
+        print(f"{pe:>8} {count:>8} {total:12.6f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -28,12 +28,65 @@ def symbolize_addresses(addresses, binary):
         print(f"symbols failed: {e}")
         return {addr: addr for addr in addresses}
 
+def load_stack_table(filename):
+    # bin_to_csv.py output keeps stacks in pstack.NNN.csv, next to pperf.NNN.csv
+    head, tail = os.path.split(filename)
+    path = os.path.join(head, 'pstack.' + tail.split('.', 1)[1])
+    if not os.path.exists(path):
+        return None
+    stacks = {}
+    with open(path, 'r') as f:
+        for row in csv.DictReader(f):
+            addrs = [a.strip() for a in row.get('Stacktrace', '').split('|') if a.strip()]
+            syms = [s.strip() for s in row.get('Symboltrace', '').split('|') if s.strip()]
+            stacks[row['Stack_ID']] = (addrs, syms)
+    return stacks
+
+def load_symbol_table(filename):
+    # backtrace_of_stacktrace.py writes psym.NNN.csv: address -> inline chain,
+    # innermost first
+    head, tail = os.path.split(filename)
+    path = os.path.join(head, 'psym.' + tail.split('.', 1)[1])
+    if not os.path.exists(path):
+        return {}
+    with open(path, 'r') as f:
+        return {row['Address']: [s for s in row['Symbol'].split('|') if s]
+                for row in csv.DictReader(f) if row.get('Symbol')}
+
+def resolve(addrs, symbols, addr_map):
+    names = []
+    for addr in addrs:
+        names.extend(symbols.get(addr) or [str(addr_map.get(addr, addr))])
+    return names
+
+def parse_clock(extra):
+    # clock_shift/clock_at from the Extra of init and finalize in csv traces,
+    # bin_to_csv.py has already applied them
+    fields = dict(p.split('=', 1) for p in extra.split(';') if '=' in p)
+    if 'clock_shift' not in fields:
+        return None
+    return int(fields['clock_shift']), int(fields['clock_at'])
+
+def clock_alignment(start, end):
+    # (shift, at, drift): Time + shift + drift * (Time - at) is PE 0's Time,
+    # all in ns
+    if start is None:
+        return 0, 0, 0.0
+    if end is None or end[1] <= start[1]:
+        return start[0], start[1], 0.0
+    return start[0], start[1], (end[0] - start[0]) / (end[1] - start[1])
+
 def convert_csv_to_perfetto(pattern="pperf.*.csv", output_file="trace.json", binary=None):
     all_trace_events = []
     stack_frames = {}
     next_frame_id = 1
     
     frame_cache = {}
+    stack_tables = {}
+    symbol_tables = {}
+    clocks = {}
+    # (pe, stack id) -> leaf frame, so each interned stack is walked once
+    stack_leaf = {}
     
     files = glob.glob(pattern)
     if not files:
@@ -51,17 +104,32 @@ def convert_csv_to_perfetto(pattern="pperf.*.csv", output_file="trace.json", bin
         except:
             pe_id = 0
             
+        symbols = symbol_tables[pe_id] = load_symbol_table(filename)
+        stacks = load_stack_table(filename)
+        if stacks is not None:
+            stack_tables[pe_id] = stacks
+            for addrs, syms in stacks.values():
+                if not syms:
+                    unique_addrs.update(a for a in addrs if a not in symbols)
+
+        clock = [None, None]
         with open(filename, 'r') as f:
             reader = csv.DictReader(f)
             for row in reader:
                 rows_data.append((pe_id, row))
+                if row.get('Function') in ('shmem_init', 'shmem_init_thread'):
+                    clock[0] = parse_clock(row.get('Extra', ''))
+                elif row.get('Function') == 'shmem_finalize':
+                    clock[1] = parse_clock(row.get('Extra', ''))
                 bt = row.get('Stacktrace', '')
                 if bt:
                     for addr in bt.split('|'):
                         addr = addr.strip()
-                        if addr:
+                        if addr and addr not in symbols:
                             unique_addrs.add(addr)
 
+        clocks[pe_id] = clock_alignment(*clock)
+
     addr_map = symbolize_addresses(unique_addrs, binary)
     
     for pe_id, row in rows_data:
@@ -72,19 +140,45 @@ def convert_csv_to_perfetto(pattern="pperf.*.csv", output_file="trace.json", bin
             target_pe = int(row.get('Target_PE', -1))
             bytes_rx = int(row.get('Bytes_RX', 0))
             bytes_tx = int(row.get('Bytes_TX', 0))
-            symbol_trace = row.get('Symboltrace', '')
-            if symbol_trace:
-                bt = [s.strip() for s in symbol_trace.split('|') if s.strip()]
-                resolved_names = bt
+            stack_id = row.get('Stack_ID')
+
+            # on PE 0's timeline
+            shift, at, drift = clocks[pe_id]
+            start_ns = start_sec * 1e9
+            start_sec = (start_ns + shift + drift * (start_ns - at)) / 1e9
+            ts_us = int(start_sec * 1_000_000)
+            dur_us = int(dur_sec * 1_000_000)
+            
+            if func == 'heap_live':
+                # a counter track per PE: live bytes and the high-water mark
+                all_trace_events.append({
+                    "name": "symmetric heap", "ph": "C", "ts": ts_us,
+                    "pid": pe_id,
+                    "args": {"live": bytes_tx, "peak": bytes_rx}
+                })
+                continue
+
+            stacks = stack_tables.get(pe_id)
+            symbols = symbol_tables[pe_id]
+            if stack_id is not None and (pe_id, stack_id) in stack_leaf:
+                resolved_names = []
+            elif stack_id is not None and stacks is not None:
+                addrs, syms = stacks.get(stack_id, ([], []))
+                resolved_names = syms or resolve(addrs, symbols, addr_map)
             else:
-                bt_raw = row.get('Stacktrace', '').split('|')
-                bt = [addr.strip() for addr in bt_raw if addr.strip()]
-                resolved_names = [str(addr_map.get(addr, addr)) for addr in bt]
+                symbol_trace = row.get('Symboltrace', '')
+                if symbol_trace:
+                    bt = [s.strip() for s in symbol_trace.split('|') if s.strip()]
+                    resolved_names = bt
+                else:
+                    bt_raw = row.get('Stacktrace', '').split('|')
+                    bt = [addr.strip() for addr in bt_raw if addr.strip()]
+                    resolved_names = resolve(bt, symbols, addr_map)
             
-            current_parent = None
+            current_parent = stack_leaf.get((pe_id, stack_id))
             # reverse because perfetto 
             for name in reversed(resolved_names):
-                if any(x in name for x in ["_osh_log_call", "_osh_wrap_"]):
+                if name.startswith('_osh_') or any(x in name for x in ["_osh_log_call", "_osh_wrap_"]):
                     continue
                 
                 key = (name, current_parent)
@@ -98,10 +192,10 @@ def convert_csv_to_perfetto(pattern="pperf.*.csv", output_file="trace.json", bin
                         stack_frames[str(frame_id)]["parent"] = current_parent
                 
                 current_parent = frame_cache[key]
+
+            if stack_id is not None and stacks is not None:
+                stack_leaf[(pe_id, stack_id)] = current_parent
                 
-            ts_us = int(start_sec * 1_000_000)
-            dur_us = int(dur_sec * 1_000_000)
-            
             event = {
                 "name": func,
                 "cat": "PERF",
@@ -109,7 +203,7 @@ def convert_csv_to_perfetto(pattern="pperf.*.csv", output_file="trace.json", bin
                 "ts": ts_us,
                 "dur": dur_us,
                 "pid": pe_id,
-                "tid": 1,
+                "tid": int(row.get('Thread') or 0) + 1,
                 "args": {
                     "target_pe": target_pe,
                     "bytes_rx": bytes_rx,
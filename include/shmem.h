@@ -13,14 +13,10 @@
 #define _GNU_SOURCE
 #define __USE_GNU
 
+#include <fcntl.h>
 #include <link.h>
-
-static int _osh_phdr_callback(struct dl_phdr_info *info, size_t size,
-                              void *data) {
-  (void)size;
-  *(uintptr_t *)data = info->dlpi_addr;
-  return 1;
-}
+#include <pthread.h>
+#include <sched.h>
 
 #ifdef _OSH_WE_DID_DEF_GNU_SOURCE
 #undef _GNU_SOURCE
@@ -31,12 +27,17 @@ static int _osh_phdr_callback(struct dl_phdr_info *info, size_t size,
        
 #endif // __linux__
 
+#include <errno.h>
 #include <execinfo.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <pshmem.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -45,152 +46,37 @@ static int _osh_phdr_callback(struct dl_phdr_info *info, size_t size,
 #include <mach-o/dyld.h>
 #endif
 
-
-#if defined(SHMEM_PERF_SETUP) && !defined(_SHMEM_INSTANTIATED)
-FILE *_osh_profile_log = NULL;
-int _osh_pe_id = -1;
-double _osh_start;
-#define _SHMEM_INSTANTIATED
-#else
-extern FILE *_osh_profile_log;
-extern int _osh_pe_id;
-extern double _osh_start;
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
 #endif
 
 #define UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define _OSH_COLD __attribute__((unused, noinline, cold))
+// the wrappers and their hot path are always inlined into the caller, even at
+// -O0, so a stack captured from a non-inlined helper starts at the call site
+#define _OSH_INLINE static inline __attribute__((always_inline))
 
-static inline double _osh_get_time(void) {
-  struct timespec ts;
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
-}
-
-const char *EMPTY_STRING = "";
-
-static inline void _osh_log_call(const char *func_name, double duration,
-                                 double start, int target_pe, size_t bytes_rx,
-                                 size_t bytes_tx, char *extra) {
-  if (UNLIKELY(_osh_profile_log == NULL)) {
-    if (_osh_pe_id == -1) {
-      return;
-    }
-
-    char filename[32];
-    snprintf(filename, sizeof(filename), "pperf.%03d.csv", _osh_pe_id);
-
-    _osh_profile_log = fopen(filename, "a");
-    if (!_osh_profile_log) {
-      perror("failed to open log file");
-      return;
-    }
-  }
-
-  void *buffer[10];
-  int nptrs = backtrace(buffer, 10);
-  char bt_str[256] = "";
-  int offset = 0;
-  for (int i = 0; i < nptrs && offset < 250; i++) {
-    offset += snprintf(bt_str + offset, 256 - offset, "%p|", buffer[i]);
-  }
-
-  fprintf(_osh_profile_log, "%.9f,%s,%.9f,%d,%zu,%zu,%s,%s\n", start - _osh_start, func_name,
-          duration, target_pe, bytes_rx, bytes_tx, bt_str,
-          extra ? extra : EMPTY_STRING);
-}
-
-// beware
-// expansion helper for inline asm in macros
-// we don't actually use this anymore but i might want it later
-#ifndef SYM_QUAL_INNER2
-#define SYM_QUAL_INNER2(p, n) #p #n
-#ifndef SYM_QUAL_INNER
-#define SYM_QUAL_INNER(p, n) SYM_QUAL_INNER2(p, n)
+// -DOSH_TRACE_<CLASS>=0 compiles a whole class of functions to plain
+// forwarders to pshmem, see the bottom of this file
+#ifndef OSH_TRACE_RMA
+#define OSH_TRACE_RMA 1
 #endif
+#ifndef OSH_TRACE_AMO
+#define OSH_TRACE_AMO 1
 #endif
-#define WRAP_SYM(n) SYM_QUAL_INNER(__USER_LABEL_PREFIX__, _osh_wrap_##n)
-
-#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)              \
-  static inline void FN_NAME DECL_ARGS {                                       \
-    double start_t = _osh_get_time();                                          \
-    p##FN_NAME CALL_ARGS;                                                      \
-    double end_t = _osh_get_time();                                            \
-    _osh_log_call(#FN_NAME, end_t - start_t, start_t, PE, RX, TX, NULL);       \
-  }
-
-#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)     \
-  static inline RET_TYPE FN_NAME DECL_ARGS {                                   \
-    double start_t = _osh_get_time();                                          \
-    RET_TYPE ret = p##FN_NAME CALL_ARGS;                                       \
-    double end_t = _osh_get_time();                                            \
-    _osh_log_call(#FN_NAME, end_t - start_t, start_t, PE, RX, TX, NULL);       \
-    return ret;                                                                \
-  }
-
-static inline void shmem_init(void) {
-  double start_t = _osh_get_time();
-
-  pshmem_init();
-  // APPROXIMATELY start of program
-  // this results in shmem_init starting at negative
-  // time, which is ok i guess
-  _osh_start = _osh_get_time();
-
-  double end_t = _osh_get_time();
-
-  _osh_pe_id = pshmem_my_pe();
-
-  char filename[32];
-  if (_osh_pe_id != -1) {
-    snprintf(filename, sizeof(filename), "pperf.%03d.csv", _osh_pe_id);
-    _osh_profile_log = fopen(filename, "w");
-  }
-
-  if (_osh_profile_log) {
-    fprintf(_osh_profile_log, "Time,Function,Duration_Sec,Target_PE,Bytes_RX,"
-                              "Bytes_TX,Stacktrace,Extra\n");
-    char extra_info[256];
-    char *hostname = (char *)malloc(sizeof(char) * 64);
-    gethostname(hostname, 64);
-
-#ifdef __APPLE__
-    intptr_t slide = _dyld_get_image_vmaddr_slide(0);
-    snprintf(extra_info, sizeof(extra_info), "host=%s;slide=%p", hostname,
-             (void *)slide);
-#elif defined(__linux__)
-    // todo: this cannot be the best solution
-    unsigned long slide = 0;
-    FILE *f = fopen("/proc/self/maps", "r");
-    if (f) {
-      if (fscanf(f, "%lx", &slide) != 1) {
-        slide = 0;
-      }
-      fclose(f);
-    }
-    snprintf(extra_info, sizeof(extra_info), "host=%s;slide=%p", hostname,
-             (void *)slide);
-#else
-    snprintf(extra_info, sizeof(extra_info), "host=%s", hostname);
+#ifndef OSH_TRACE_COLLECTIVE
+#define OSH_TRACE_COLLECTIVE 1
+#endif
+#ifndef OSH_TRACE_SYNC
+#define OSH_TRACE_SYNC 1
+#endif
+#ifndef OSH_TRACE_MEMORY
+#define OSH_TRACE_MEMORY 1
+#endif
+#ifndef OSH_TRACE_SETUP
+#define OSH_TRACE_SETUP 1
 #endif
-
-    _osh_log_call("shmem_init", end_t - start_t, start_t, -1, 0, 0, extra_info);
-    free(hostname);
-  }
-}
-
-static inline void shmem_finalize(void) {
-  double start_t = _osh_get_time();
-
-  pshmem_finalize();
-
-  double end_t = _osh_get_time();
-
-  _osh_log_call("shmem_finalize", end_t - start_t, start_t, -1, 0, 0, NULL);
-
-  if (_osh_profile_log) {
-    fclose(_osh_profile_log);
-    _osh_profile_log = NULL;
-  }
-}
 
 // from osss-ucx
 
@@ -355,6 +241,34 @@ static inline void shmem_finalize(void) {
   X(double _Complex, complexd)                                                 \
   X(float _Complex, complexf)
 
+#define SHMEM_PT2PT_SYNC_TYPE_TABLE(X)                                         \
+  X(short, short)                                                              \
+  X(int, int)                                                                  \
+  X(long, long)                                                                \
+  X(long long, longlong)                                                       \
+  X(unsigned short, ushort)                                                    \
+  X(unsigned int, uint)                                                        \
+  X(unsigned long, ulong)                                                      \
+  X(unsigned long long, ulonglong)                                             \
+  X(int32_t, int32)                                                            \
+  X(int64_t, int64)                                                            \
+  X(uint32_t, uint32)                                                          \
+  X(uint64_t, uint64)                                                          \
+  X(size_t, size)                                                              \
+  X(ptrdiff_t, ptrdiff)
+
+#define SHMEM_SIZED_TYPE_TABLE(X)                                              \
+  X(8)                                                                         \
+  X(16)                                                                        \
+  X(32)                                                                        \
+  X(64)                                                                        \
+  X(128)
+
+// collectives on a team or an active set pass the expression naming it
+// first. only the traced wrappers use it, every other expansion drops it
+#define WRAP_CALL_TEAM_VOID(TEAM, ...) WRAP_CALL_VOID(__VA_ARGS__)
+#define WRAP_CALL_TEAM_RET(TEAM, ...) WRAP_CALL_RET(__VA_ARGS__)
+
 #define SHMEM_RMA_HELPER(CT, ST)                                               \
   WRAP_CALL_VOID(shmem_##ST##_put,                                             \
                  (CT * dest, const CT *src, size_t nelems, int pe),            \
@@ -383,7 +297,6 @@ static inline void shmem_finalize(void) {
                  (dest, src, dst, sst, nelems, pe), pe, nelems * sizeof(CT),   \
                  0)
 
-SHMEM_STANDARD_RMA_TYPE_TABLE(SHMEM_RMA_HELPER)
 
 #define SHMEM_AMO_HELPER(CT, ST)                                               \
   WRAP_CALL_RET(CT, shmem_##ST##_atomic_fetch, (CT * dest, int pe),            \
@@ -392,9 +305,13 @@ SHMEM_STANDARD_RMA_TYPE_TABLE(SHMEM_RMA_HELPER)
                  (CT * fetch, CT * dest, int pe), (fetch, dest, pe), pe,       \
                  sizeof(CT), 0)                                                \
   WRAP_CALL_VOID(shmem_##ST##_atomic_set, (CT * dest, CT val, int pe),         \
-                 (dest, val, pe), pe, 0, sizeof(CT))
+                 (dest, val, pe), pe, 0, sizeof(CT))                           \
+  WRAP_CALL_RET(CT, shmem_##ST##_atomic_swap, (CT * dest, CT val, int pe),     \
+                (dest, val, pe), pe, sizeof(CT), sizeof(CT))                   \
+  WRAP_CALL_VOID(shmem_##ST##_atomic_swap_nbi,                                 \
+                 (CT * fetch, CT * dest, CT val, int pe),                      \
+                 (fetch, dest, val, pe), pe, sizeof(CT), sizeof(CT))
 
-SHMEM_EXTENDED_AMO_TYPE_TABLE(SHMEM_AMO_HELPER)
 
 #define SHMEM_AMO_ARITH_HELPER(CT, ST)                                         \
   WRAP_CALL_RET(CT, shmem_##ST##_atomic_fetch_inc, (CT * dest, int pe),        \
@@ -414,9 +331,11 @@ SHMEM_EXTENDED_AMO_TYPE_TABLE(SHMEM_AMO_HELPER)
                  (dest, value, pe), pe, 0, sizeof(CT))                         \
   WRAP_CALL_RET(CT, shmem_##ST##_atomic_compare_swap,                          \
                 (CT * dest, CT cond, CT val, int pe), (dest, cond, val, pe),   \
-                pe, sizeof(CT), sizeof(CT))
+                pe, sizeof(CT), sizeof(CT))                                    \
+  WRAP_CALL_VOID(shmem_##ST##_atomic_compare_swap_nbi,                         \
+                 (CT * fetch, CT * dest, CT cond, CT val, int pe),             \
+                 (fetch, dest, cond, val, pe), pe, sizeof(CT), sizeof(CT))
 
-SHMEM_STANDARD_AMO_TYPE_TABLE(SHMEM_AMO_ARITH_HELPER)
 
 #define SHMEM_AMO_BITWISE_HELPER(CT, ST)                                       \
   WRAP_CALL_RET(CT, shmem_##ST##_atomic_fetch_and,                             \
@@ -444,124 +363,4504 @@ SHMEM_STANDARD_AMO_TYPE_TABLE(SHMEM_AMO_ARITH_HELPER)
   WRAP_CALL_VOID(shmem_##ST##_atomic_xor, (CT * dest, CT value, int pe),       \
                  (dest, value, pe), pe, 0, sizeof(CT))
 
-SHMEM_BITWISE_AMO_TYPE_TABLE(SHMEM_AMO_BITWISE_HELPER)
 
 #define SHMEM_TO_ALL_BITWISE_HELPER(CT, ST)                                    \
-  WRAP_CALL_VOID(                                                              \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size),                        \
       shmem_##ST##_and_to_all,                                                 \
       (CT * dest, const CT *source, int nreduce, int PE_start,                 \
        int logPE_stride, int PE_size, CT *pWrk, long *pSync),                  \
       (dest, source, nreduce, PE_start, logPE_stride, PE_size, pWrk, pSync),   \
       -1, nreduce * sizeof(CT), nreduce * sizeof(CT))                          \
-  WRAP_CALL_VOID(                                                              \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size),                        \
       shmem_##ST##_or_to_all,                                                  \
       (CT * dest, const CT *source, int nreduce, int PE_start,                 \
        int logPE_stride, int PE_size, CT *pWrk, long *pSync),                  \
       (dest, source, nreduce, PE_start, logPE_stride, PE_size, pWrk, pSync),   \
       -1, nreduce * sizeof(CT), nreduce * sizeof(CT))                          \
-  WRAP_CALL_VOID(                                                              \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size),                        \
       shmem_##ST##_xor_to_all,                                                 \
       (CT * dest, const CT *source, int nreduce, int PE_start,                 \
        int logPE_stride, int PE_size, CT *pWrk, long *pSync),                  \
       (dest, source, nreduce, PE_start, logPE_stride, PE_size, pWrk, pSync),   \
       -1, nreduce * sizeof(CT), nreduce * sizeof(CT))
 
-SHMEM_TO_ALL_BITWISE_TYPE_TABLE(SHMEM_TO_ALL_BITWISE_HELPER)
 
 #define SHMEM_TO_ALL_MINMAX_HELPER(CT, ST)                                     \
-  WRAP_CALL_VOID(                                                              \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size),                        \
       shmem_##ST##_max_to_all,                                                 \
       (CT * dest, const CT *source, int nreduce, int PE_start,                 \
        int logPE_stride, int PE_size, CT *pWrk, long *pSync),                  \
       (dest, source, nreduce, PE_start, logPE_stride, PE_size, pWrk, pSync),   \
       -1, nreduce * sizeof(CT), nreduce * sizeof(CT))                          \
-  WRAP_CALL_VOID(                                                              \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size),                        \
       shmem_##ST##_min_to_all,                                                 \
       (CT * dest, const CT *source, int nreduce, int PE_start,                 \
        int logPE_stride, int PE_size, CT *pWrk, long *pSync),                  \
       (dest, source, nreduce, PE_start, logPE_stride, PE_size, pWrk, pSync),   \
       -1, nreduce * sizeof(CT), nreduce * sizeof(CT))
 
-SHMEM_TO_ALL_MINMAX_TYPE_TABLE(SHMEM_TO_ALL_MINMAX_HELPER)
 
 #define SHMEM_TO_ALL_ARITH_HELPER(CT, ST)                                      \
-  WRAP_CALL_VOID(                                                              \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size),                        \
       shmem_##ST##_sum_to_all,                                                 \
       (CT * dest, const CT *source, int nreduce, int PE_start,                 \
        int logPE_stride, int PE_size, CT *pWrk, long *pSync),                  \
       (dest, source, nreduce, PE_start, logPE_stride, PE_size, pWrk, pSync),   \
       -1, nreduce * sizeof(CT), nreduce * sizeof(CT))                          \
-  WRAP_CALL_VOID(                                                              \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size),                        \
       shmem_##ST##_prod_to_all,                                                \
       (CT * dest, const CT *source, int nreduce, int PE_start,                 \
        int logPE_stride, int PE_size, CT *pWrk, long *pSync),                  \
       (dest, source, nreduce, PE_start, logPE_stride, PE_size, pWrk, pSync),   \
       -1, nreduce * sizeof(CT), nreduce * sizeof(CT))
 
-SHMEM_TO_ALL_ARITH_TYPE_TABLE(SHMEM_TO_ALL_ARITH_HELPER)
 
 #define SHMEM_REDUCE_BITWISE_HELPER(CT, ST)                                    \
-  WRAP_CALL_RET(                                                               \
-      int, shmem_##ST##_and_reduce,                                            \
+  WRAP_CALL_TEAM_RET(                                                          \
+      _osh_team_of(team), int, shmem_##ST##_and_reduce,                        \
       (shmem_team_t team, CT * dest, const CT *source, size_t nreduce),        \
       (team, dest, source, nreduce), -1, nreduce * sizeof(CT),                 \
       nreduce * sizeof(CT))                                                    \
-  WRAP_CALL_RET(                                                               \
-      int, shmem_##ST##_or_reduce,                                             \
+  WRAP_CALL_TEAM_RET(                                                          \
+      _osh_team_of(team), int, shmem_##ST##_or_reduce,                         \
       (shmem_team_t team, CT * dest, const CT *source, size_t nreduce),        \
       (team, dest, source, nreduce), -1, nreduce * sizeof(CT),                 \
       nreduce * sizeof(CT))                                                    \
-  WRAP_CALL_RET(                                                               \
-      int, shmem_##ST##_xor_reduce,                                            \
+  WRAP_CALL_TEAM_RET(                                                          \
+      _osh_team_of(team), int, shmem_##ST##_xor_reduce,                        \
       (shmem_team_t team, CT * dest, const CT *source, size_t nreduce),        \
       (team, dest, source, nreduce), -1, nreduce * sizeof(CT),                 \
       nreduce * sizeof(CT))
 
-SHMEM_REDUCE_BITWISE_TYPE_TABLE(SHMEM_REDUCE_BITWISE_HELPER)
 
 #define SHMEM_REDUCE_MINMAX_HELPER(CT, ST)                                     \
-  WRAP_CALL_RET(                                                               \
-      int, shmem_##ST##_max_reduce,                                            \
+  WRAP_CALL_TEAM_RET(                                                          \
+      _osh_team_of(team), int, shmem_##ST##_max_reduce,                        \
       (shmem_team_t team, CT * dest, const CT *source, size_t nreduce),        \
       (team, dest, source, nreduce), -1, nreduce * sizeof(CT),                 \
       nreduce * sizeof(CT))                                                    \
-  WRAP_CALL_RET(                                                               \
-      int, shmem_##ST##_min_reduce,                                            \
+  WRAP_CALL_TEAM_RET(                                                          \
+      _osh_team_of(team), int, shmem_##ST##_min_reduce,                        \
       (shmem_team_t team, CT * dest, const CT *source, size_t nreduce),        \
       (team, dest, source, nreduce), -1, nreduce * sizeof(CT),                 \
       nreduce * sizeof(CT))
 
-SHMEM_REDUCE_MINMAX_TYPE_TABLE(SHMEM_REDUCE_MINMAX_HELPER)
 
 #define SHMEM_REDUCE_ARITH_HELPER(CT, ST)                                      \
-  WRAP_CALL_RET(                                                               \
-      int, shmem_##ST##_sum_reduce,                                            \
+  WRAP_CALL_TEAM_RET(                                                          \
+      _osh_team_of(team), int, shmem_##ST##_sum_reduce,                        \
       (shmem_team_t team, CT * dest, const CT *source, size_t nreduce),        \
       (team, dest, source, nreduce), -1, nreduce * sizeof(CT),                 \
       nreduce * sizeof(CT))                                                    \
-  WRAP_CALL_RET(                                                               \
-      int, shmem_##ST##_prod_reduce,                                           \
+  WRAP_CALL_TEAM_RET(                                                          \
+      _osh_team_of(team), int, shmem_##ST##_prod_reduce,                       \
       (shmem_team_t team, CT * dest, const CT *source, size_t nreduce),        \
       (team, dest, source, nreduce), -1, nreduce * sizeof(CT),                 \
       nreduce * sizeof(CT))
 
-SHMEM_REDUCE_ARITH_TYPE_TABLE(SHMEM_REDUCE_ARITH_HELPER)
+#define SHMEM_CTX_RMA_HELPER(CT, ST)                                           \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_put,                                         \
+                 (shmem_ctx_t ctx, CT * dest, const CT *src, size_t nelems,    \
+                  int pe),                                                     \
+                 (ctx, dest, src, nelems, pe), pe, 0, nelems * sizeof(CT))     \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_get,                                         \
+                 (shmem_ctx_t ctx, CT * dest, const CT *src, size_t nelems,    \
+                  int pe),                                                     \
+                 (ctx, dest, src, nelems, pe), pe, nelems * sizeof(CT), 0)     \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_put_nbi,                                     \
+                 (shmem_ctx_t ctx, CT * dest, const CT *src, size_t nelems,    \
+                  int pe),                                                     \
+                 (ctx, dest, src, nelems, pe), pe, 0, nelems * sizeof(CT))     \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_get_nbi,                                     \
+                 (shmem_ctx_t ctx, CT * dest, const CT *src, size_t nelems,    \
+                  int pe),                                                     \
+                 (ctx, dest, src, nelems, pe), pe, nelems * sizeof(CT), 0)     \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_p,                                           \
+                 (shmem_ctx_t ctx, CT * dest, CT value, int pe),               \
+                 (ctx, dest, value, pe), pe, 0, sizeof(CT))                    \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_g,                                        \
+                (shmem_ctx_t ctx, const CT *dest, int pe), (ctx, dest, pe),    \
+                pe, sizeof(CT), 0)                                             \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_iput,                                        \
+                 (shmem_ctx_t ctx, CT * dest, const CT *src, ptrdiff_t dst,    \
+                  ptrdiff_t sst, size_t nelems, int pe),                       \
+                 (ctx, dest, src, dst, sst, nelems, pe), pe, 0,                \
+                 nelems * sizeof(CT))                                          \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_iget,                                        \
+                 (shmem_ctx_t ctx, CT * dest, const CT *src, ptrdiff_t dst,    \
+                  ptrdiff_t sst, size_t nelems, int pe),                       \
+                 (ctx, dest, src, dst, sst, nelems, pe), pe,                   \
+                 nelems * sizeof(CT), 0)
+
+
+#define SHMEM_SIZED_RMA_HELPER(SIZE)                                           \
+  WRAP_CALL_VOID(shmem_put##SIZE,                                              \
+                 (void *dest, const void *src, size_t nelems, int pe),         \
+                 (dest, src, nelems, pe), pe, 0, nelems *(SIZE / 8))           \
+  WRAP_CALL_VOID(shmem_get##SIZE,                                              \
+                 (void *dest, const void *src, size_t nelems, int pe),         \
+                 (dest, src, nelems, pe), pe, nelems *(SIZE / 8), 0)           \
+  WRAP_CALL_VOID(shmem_put##SIZE##_nbi,                                        \
+                 (void *dest, const void *src, size_t nelems, int pe),         \
+                 (dest, src, nelems, pe), pe, 0, nelems *(SIZE / 8))           \
+  WRAP_CALL_VOID(shmem_get##SIZE##_nbi,                                        \
+                 (void *dest, const void *src, size_t nelems, int pe),         \
+                 (dest, src, nelems, pe), pe, nelems *(SIZE / 8), 0)           \
+  WRAP_CALL_VOID(shmem_iput##SIZE,                                             \
+                 (void *dest, const void *src, ptrdiff_t dst, ptrdiff_t sst,   \
+                  size_t nelems, int pe),                                      \
+                 (dest, src, dst, sst, nelems, pe), pe, 0,                     \
+                 nelems *(SIZE / 8))                                           \
+  WRAP_CALL_VOID(shmem_iget##SIZE,                                             \
+                 (void *dest, const void *src, ptrdiff_t dst, ptrdiff_t sst,   \
+                  size_t nelems, int pe),                                      \
+                 (dest, src, dst, sst, nelems, pe), pe, nelems *(SIZE / 8),    \
+                 0)                                                            \
+  WRAP_CALL_VOID(shmem_ctx_put##SIZE,                                          \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, int pe),                                      \
+                 (ctx, dest, src, nelems, pe), pe, 0, nelems *(SIZE / 8))      \
+  WRAP_CALL_VOID(shmem_ctx_get##SIZE,                                          \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, int pe),                                      \
+                 (ctx, dest, src, nelems, pe), pe, nelems *(SIZE / 8), 0)      \
+  WRAP_CALL_VOID(shmem_ctx_put##SIZE##_nbi,                                    \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, int pe),                                      \
+                 (ctx, dest, src, nelems, pe), pe, 0, nelems *(SIZE / 8))      \
+  WRAP_CALL_VOID(shmem_ctx_get##SIZE##_nbi,                                    \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, int pe),                                      \
+                 (ctx, dest, src, nelems, pe), pe, nelems *(SIZE / 8), 0)
+
+
+#define SHMEM_SIGNAL_HELPER(CT, ST)                                            \
+  WRAP_CALL_VOID(shmem_##ST##_put_signal,                                      \
+                 (CT * dest, const CT *src, size_t nelems, uint64_t *sig_addr, \
+                  uint64_t signal, int sig_op, int pe),                        \
+                 (dest, src, nelems, sig_addr, signal, sig_op, pe), pe, 0,     \
+                 nelems * sizeof(CT) + sizeof(uint64_t))                       \
+  WRAP_CALL_VOID(shmem_##ST##_put_signal_nbi,                                  \
+                 (CT * dest, const CT *src, size_t nelems, uint64_t *sig_addr, \
+                  uint64_t signal, int sig_op, int pe),                        \
+                 (dest, src, nelems, sig_addr, signal, sig_op, pe), pe, 0,     \
+                 nelems * sizeof(CT) + sizeof(uint64_t))                       \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_put_signal,                                  \
+                 (shmem_ctx_t ctx, CT * dest, const CT *src, size_t nelems,    \
+                  uint64_t *sig_addr, uint64_t signal, int sig_op, int pe),    \
+                 (ctx, dest, src, nelems, sig_addr, signal, sig_op, pe), pe,   \
+                 0, nelems * sizeof(CT) + sizeof(uint64_t))                    \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_put_signal_nbi,                              \
+                 (shmem_ctx_t ctx, CT * dest, const CT *src, size_t nelems,    \
+                  uint64_t *sig_addr, uint64_t signal, int sig_op, int pe),    \
+                 (ctx, dest, src, nelems, sig_addr, signal, sig_op, pe), pe,   \
+                 0, nelems * sizeof(CT) + sizeof(uint64_t))
+
+
+#define SHMEM_SIZED_SIGNAL_HELPER(SIZE)                                        \
+  WRAP_CALL_VOID(shmem_put##SIZE##_signal,                                     \
+                 (void *dest, const void *src, size_t nelems,                  \
+                  uint64_t *sig_addr, uint64_t signal, int sig_op, int pe),    \
+                 (dest, src, nelems, sig_addr, signal, sig_op, pe), pe, 0,     \
+                 nelems *(SIZE / 8) + sizeof(uint64_t))                        \
+  WRAP_CALL_VOID(shmem_put##SIZE##_signal_nbi,                                 \
+                 (void *dest, const void *src, size_t nelems,                  \
+                  uint64_t *sig_addr, uint64_t signal, int sig_op, int pe),    \
+                 (dest, src, nelems, sig_addr, signal, sig_op, pe), pe, 0,     \
+                 nelems *(SIZE / 8) + sizeof(uint64_t))                        \
+  WRAP_CALL_VOID(shmem_ctx_put##SIZE##_signal,                                 \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, uint64_t *sig_addr, uint64_t signal,          \
+                  int sig_op, int pe),                                         \
+                 (ctx, dest, src, nelems, sig_addr, signal, sig_op, pe), pe,   \
+                 0, nelems *(SIZE / 8) + sizeof(uint64_t))                     \
+  WRAP_CALL_VOID(shmem_ctx_put##SIZE##_signal_nbi,                             \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, uint64_t *sig_addr, uint64_t signal,          \
+                  int sig_op, int pe),                                         \
+                 (ctx, dest, src, nelems, sig_addr, signal, sig_op, pe), pe,   \
+                 0, nelems *(SIZE / 8) + sizeof(uint64_t))
+
+
+#define SHMEM_CTX_AMO_HELPER(CT, ST)                                           \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_atomic_fetch,                             \
+                (shmem_ctx_t ctx, CT * dest, int pe), (ctx, dest, pe), pe,     \
+                sizeof(CT), 0)                                                 \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_fetch_nbi,                            \
+                 (shmem_ctx_t ctx, CT * fetch, CT * dest, int pe),             \
+                 (ctx, fetch, dest, pe), pe, sizeof(CT), 0)                    \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_set,                                  \
+                 (shmem_ctx_t ctx, CT * dest, CT val, int pe),                 \
+                 (ctx, dest, val, pe), pe, 0, sizeof(CT))                      \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_atomic_swap,                              \
+                (shmem_ctx_t ctx, CT * dest, CT val, int pe),                  \
+                (ctx, dest, val, pe), pe, sizeof(CT), sizeof(CT))              \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_swap_nbi,                             \
+                 (shmem_ctx_t ctx, CT * fetch, CT * dest, CT val, int pe),     \
+                 (ctx, fetch, dest, val, pe), pe, sizeof(CT), sizeof(CT))
+
+
+
+#define SHMEM_CTX_AMO_ARITH_HELPER(CT, ST)                                     \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_atomic_fetch_inc,                         \
+                (shmem_ctx_t ctx, CT * dest, int pe), (ctx, dest, pe), pe,     \
+                sizeof(CT), 0)                                                 \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_fetch_inc_nbi,                        \
+                 (shmem_ctx_t ctx, CT * fetch, CT * dest, int pe),             \
+                 (ctx, fetch, dest, pe), pe, sizeof(CT), 0)                    \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_inc,                                  \
+                 (shmem_ctx_t ctx, CT * dest, int pe), (ctx, dest, pe), pe,    \
+                 0, sizeof(CT))                                                \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_atomic_fetch_add,                         \
+                (shmem_ctx_t ctx, CT * dest, CT value, int pe),                \
+                (ctx, dest, value, pe), pe, sizeof(CT), sizeof(CT))            \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_fetch_add_nbi,                        \
+                 (shmem_ctx_t ctx, CT * fetch, CT * dest, CT value, int pe),   \
+                 (ctx, fetch, dest, value, pe), pe, sizeof(CT), sizeof(CT))    \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_add,                                  \
+                 (shmem_ctx_t ctx, CT * dest, CT value, int pe),               \
+                 (ctx, dest, value, pe), pe, 0, sizeof(CT))                    \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_atomic_compare_swap,                      \
+                (shmem_ctx_t ctx, CT * dest, CT cond, CT val, int pe),         \
+                (ctx, dest, cond, val, pe), pe, sizeof(CT), sizeof(CT))        \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_compare_swap_nbi,                     \
+                 (shmem_ctx_t ctx, CT * fetch, CT * dest, CT cond, CT val,     \
+                  int pe),                                                     \
+                 (ctx, fetch, dest, cond, val, pe), pe, sizeof(CT),            \
+                 sizeof(CT))
+
+
 
-WRAP_CALL_VOID(shmem_barrier_all, (void), (), -1, 0, 0)
-WRAP_CALL_VOID(shmem_fence, (void), (), -1, 0, 0)
-WRAP_CALL_VOID(shmem_quiet, (void), (), -1, 0, 0)
-WRAP_CALL_RET(int, shmem_my_pe, (void), (), -1, 0, 0)
-WRAP_CALL_RET(int, shmem_n_pes, (void), (), -1, 0, 0)
+#define SHMEM_CTX_AMO_BITWISE_HELPER(CT, ST)                                   \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_atomic_fetch_and,                         \
+                (shmem_ctx_t ctx, CT * dest, CT value, int pe),                \
+                (ctx, dest, value, pe), pe, sizeof(CT), sizeof(CT))            \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_fetch_and_nbi,                        \
+                 (shmem_ctx_t ctx, CT * fetch, CT * dest, CT value, int pe),   \
+                 (ctx, fetch, dest, value, pe), pe, sizeof(CT), sizeof(CT))    \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_and,                                  \
+                 (shmem_ctx_t ctx, CT * dest, CT value, int pe),               \
+                 (ctx, dest, value, pe), pe, 0, sizeof(CT))                    \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_atomic_fetch_or,                          \
+                (shmem_ctx_t ctx, CT * dest, CT value, int pe),                \
+                (ctx, dest, value, pe), pe, sizeof(CT), sizeof(CT))            \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_fetch_or_nbi,                         \
+                 (shmem_ctx_t ctx, CT * fetch, CT * dest, CT value, int pe),   \
+                 (ctx, fetch, dest, value, pe), pe, sizeof(CT), sizeof(CT))    \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_or,                                   \
+                 (shmem_ctx_t ctx, CT * dest, CT value, int pe),               \
+                 (ctx, dest, value, pe), pe, 0, sizeof(CT))                    \
+  WRAP_CALL_RET(CT, shmem_ctx_##ST##_atomic_fetch_xor,                         \
+                (shmem_ctx_t ctx, CT * dest, CT value, int pe),                \
+                (ctx, dest, value, pe), pe, sizeof(CT), sizeof(CT))            \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_fetch_xor_nbi,                        \
+                 (shmem_ctx_t ctx, CT * fetch, CT * dest, CT value, int pe),   \
+                 (ctx, fetch, dest, value, pe), pe, sizeof(CT), sizeof(CT))    \
+  WRAP_CALL_VOID(shmem_ctx_##ST##_atomic_xor,                                  \
+                 (shmem_ctx_t ctx, CT * dest, CT value, int pe),               \
+                 (ctx, dest, value, pe), pe, 0, sizeof(CT))
+
+
+#define SHMEM_PT2PT_SYNC_HELPER(CT, ST)                                        \
+  WRAP_CALL_VOID(shmem_##ST##_wait_until, (CT * ivar, int cmp, CT cmp_value),  \
+                 (ivar, cmp, cmp_value), -1, 0, 0)                             \
+  WRAP_CALL_VOID(shmem_##ST##_wait_until_all,                                  \
+                 (CT * ivars, size_t nelems, const int *status, int cmp,       \
+                  CT cmp_value),                                               \
+                 (ivars, nelems, status, cmp, cmp_value), -1, 0, 0)            \
+  WRAP_CALL_RET(size_t, shmem_##ST##_wait_until_any,                           \
+                (CT * ivars, size_t nelems, const int *status, int cmp,        \
+                 CT cmp_value),                                                \
+                (ivars, nelems, status, cmp, cmp_value), -1, 0, 0)             \
+  WRAP_CALL_RET(size_t, shmem_##ST##_wait_until_some,                          \
+                (CT * ivars, size_t nelems, size_t *indices,                   \
+                 const int *status, int cmp, CT cmp_value),                    \
+                (ivars, nelems, indices, status, cmp, cmp_value), -1, 0, 0)    \
+  WRAP_CALL_VOID(shmem_##ST##_wait_until_all_vector,                           \
+                 (CT * ivars, size_t nelems, const int *status, int cmp,       \
+                  CT *cmp_values),                                             \
+                 (ivars, nelems, status, cmp, cmp_values), -1, 0, 0)           \
+  WRAP_CALL_RET(size_t, shmem_##ST##_wait_until_any_vector,                    \
+                (CT * ivars, size_t nelems, const int *status, int cmp,        \
+                 CT *cmp_values),                                              \
+                (ivars, nelems, status, cmp, cmp_values), -1, 0, 0)            \
+  WRAP_CALL_RET(size_t, shmem_##ST##_wait_until_some_vector,                   \
+                (CT * ivars, size_t nelems, size_t *indices,                   \
+                 const int *status, int cmp, CT *cmp_values),                  \
+                (ivars, nelems, indices, status, cmp, cmp_values), -1, 0, 0)   \
+  WRAP_CALL_RET(int, shmem_##ST##_test, (CT * ivar, int cmp, CT cmp_value),    \
+                (ivar, cmp, cmp_value), -1, 0, 0)                              \
+  WRAP_CALL_RET(int, shmem_##ST##_test_all,                                    \
+                (CT * ivars, size_t nelems, const int *status, int cmp,        \
+                 CT cmp_value),                                                \
+                (ivars, nelems, status, cmp, cmp_value), -1, 0, 0)             \
+  WRAP_CALL_RET(size_t, shmem_##ST##_test_any,                                 \
+                (CT * ivars, size_t nelems, const int *status, int cmp,        \
+                 CT cmp_value),                                                \
+                (ivars, nelems, status, cmp, cmp_value), -1, 0, 0)             \
+  WRAP_CALL_RET(size_t, shmem_##ST##_test_some,                                \
+                (CT * ivars, size_t nelems, size_t *indices,                   \
+                 const int *status, int cmp, CT cmp_value),                    \
+                (ivars, nelems, indices, status, cmp, cmp_value), -1, 0, 0)    \
+  WRAP_CALL_RET(int, shmem_##ST##_test_all_vector,                             \
+                (CT * ivars, size_t nelems, const int *status, int cmp,        \
+                 CT *cmp_values),                                              \
+                (ivars, nelems, status, cmp, cmp_values), -1, 0, 0)            \
+  WRAP_CALL_RET(size_t, shmem_##ST##_test_any_vector,                          \
+                (CT * ivars, size_t nelems, const int *status, int cmp,        \
+                 CT *cmp_values),                                              \
+                (ivars, nelems, status, cmp, cmp_values), -1, 0, 0)            \
+  WRAP_CALL_RET(size_t, shmem_##ST##_test_some_vector,                         \
+                (CT * ivars, size_t nelems, size_t *indices,                   \
+                 const int *status, int cmp, CT *cmp_values),                  \
+                (ivars, nelems, indices, status, cmp, cmp_values), -1, 0, 0)
+
+
+#define SHMEM_COLLECTIVE_HELPER(CT, ST)                                        \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_##ST##_alltoall,           \
+                     (shmem_team_t team, CT * dest, const CT *source,          \
+                      size_t nelems),                                          \
+                     (team, dest, source, nelems), -1,                         \
+                     nelems * sizeof(CT) * pshmem_team_n_pes(team),            \
+                     nelems * sizeof(CT) * pshmem_team_n_pes(team))            \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_##ST##_alltoalls,          \
+                     (shmem_team_t team, CT * dest, const CT *source,          \
+                      ptrdiff_t dst, ptrdiff_t sst, size_t nelems),            \
+                     (team, dest, source, dst, sst, nelems), -1,               \
+                     nelems * sizeof(CT) * pshmem_team_n_pes(team),            \
+                     nelems * sizeof(CT) * pshmem_team_n_pes(team))            \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_##ST##_broadcast,          \
+                     (shmem_team_t team, CT * dest, const CT *source,          \
+                      size_t nelems, int PE_root),                             \
+                     (team, dest, source, nelems, PE_root), -1,                \
+                     (pshmem_team_my_pe(team) == PE_root                       \
+                          ? 0                                                  \
+                          : nelems * sizeof(CT)),                              \
+                     (pshmem_team_my_pe(team) == PE_root                       \
+                          ? nelems * sizeof(CT)                                \
+                          : 0))                                                \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_##ST##_collect,            \
+                     (shmem_team_t team, CT * dest, const CT *source,          \
+                      size_t nelems),                                          \
+                     (team, dest, source, nelems), -1, 0, nelems * sizeof(CT)) \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_##ST##_fcollect,           \
+                     (shmem_team_t team, CT * dest, const CT *source,          \
+                      size_t nelems),                                          \
+                     (team, dest, source, nelems), -1,                         \
+                     nelems * sizeof(CT) * pshmem_team_n_pes(team),            \
+                     nelems * sizeof(CT))
+
+
+#define SHMEM_MEM_RMA_HELPER()                                                 \
+  WRAP_CALL_VOID(shmem_putmem,                                                 \
+                 (void *dest, const void *src, size_t nelems, int pe),         \
+                 (dest, src, nelems, pe), pe, 0, nelems)                       \
+  WRAP_CALL_VOID(shmem_getmem,                                                 \
+                 (void *dest, const void *src, size_t nelems, int pe),         \
+                 (dest, src, nelems, pe), pe, nelems, 0)                       \
+  WRAP_CALL_VOID(shmem_putmem_nbi,                                             \
+                 (void *dest, const void *src, size_t nelems, int pe),         \
+                 (dest, src, nelems, pe), pe, 0, nelems)                       \
+  WRAP_CALL_VOID(shmem_getmem_nbi,                                             \
+                 (void *dest, const void *src, size_t nelems, int pe),         \
+                 (dest, src, nelems, pe), pe, nelems, 0)                       \
+  WRAP_CALL_VOID(shmem_ctx_putmem,                                             \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, int pe),                                      \
+                 (ctx, dest, src, nelems, pe), pe, 0, nelems)                  \
+  WRAP_CALL_VOID(shmem_ctx_getmem,                                             \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, int pe),                                      \
+                 (ctx, dest, src, nelems, pe), pe, nelems, 0)                  \
+  WRAP_CALL_VOID(shmem_ctx_putmem_nbi,                                         \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, int pe),                                      \
+                 (ctx, dest, src, nelems, pe), pe, 0, nelems)                  \
+  WRAP_CALL_VOID(shmem_ctx_getmem_nbi,                                         \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, int pe),                                      \
+                 (ctx, dest, src, nelems, pe), pe, nelems, 0)                  \
+  WRAP_CALL_VOID(shmem_putmem_signal,                                          \
+                 (void *dest, const void *src, size_t nelems,                  \
+                  uint64_t *sig_addr, uint64_t signal, int sig_op, int pe),    \
+                 (dest, src, nelems, sig_addr, signal, sig_op, pe), pe, 0,     \
+                 nelems + sizeof(uint64_t))                                    \
+  WRAP_CALL_VOID(shmem_putmem_signal_nbi,                                      \
+                 (void *dest, const void *src, size_t nelems,                  \
+                  uint64_t *sig_addr, uint64_t signal, int sig_op, int pe),    \
+                 (dest, src, nelems, sig_addr, signal, sig_op, pe), pe, 0,     \
+                 nelems + sizeof(uint64_t))                                    \
+  WRAP_CALL_VOID(shmem_ctx_putmem_signal,                                      \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, uint64_t *sig_addr, uint64_t signal,          \
+                  int sig_op, int pe),                                         \
+                 (ctx, dest, src, nelems, sig_addr, signal, sig_op, pe), pe,   \
+                 0, nelems + sizeof(uint64_t))                                 \
+  WRAP_CALL_VOID(shmem_ctx_putmem_signal_nbi,                                  \
+                 (shmem_ctx_t ctx, void *dest, const void *src,                \
+                  size_t nelems, uint64_t *sig_addr, uint64_t signal,          \
+                  int sig_op, int pe),                                         \
+                 (ctx, dest, src, nelems, sig_addr, signal, sig_op, pe), pe,   \
+                 0, nelems + sizeof(uint64_t))
+
+#define SHMEM_MEM_COLLECTIVE_HELPER()                                          \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_alltoallmem,               \
+                     (shmem_team_t team, void *dest, const void *source,       \
+                      size_t nelems),                                          \
+                     (team, dest, source, nelems), -1,                         \
+                     nelems * pshmem_team_n_pes(team),                         \
+                     nelems * pshmem_team_n_pes(team))                         \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_broadcastmem,              \
+                     (shmem_team_t team, void *dest, const void *source,       \
+                      size_t nelems, int PE_root),                             \
+                     (team, dest, source, nelems, PE_root), -1,                \
+                     (pshmem_team_my_pe(team) == PE_root ? 0 : nelems),        \
+                     (pshmem_team_my_pe(team) == PE_root ? nelems : 0))        \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_collectmem,                \
+                     (shmem_team_t team, void *dest, const void *source,       \
+                      size_t nelems),                                          \
+                     (team, dest, source, nelems), -1, 0, nelems)              \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_fcollectmem,               \
+                     (shmem_team_t team, void *dest, const void *source,       \
+                      size_t nelems),                                          \
+                     (team, dest, source, nelems), -1,                         \
+                     nelems * pshmem_team_n_pes(team), nelems)
+
+// the deprecated active-set collectives, 32 and 64 bit elements
+#define SHMEM_ACTIVE_SET_COLLECTIVE_HELPER(SIZE)                               \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size), shmem_alltoall##SIZE,  \
+      (void *dest, const void *source, size_t nelems, int PE_start,            \
+       int logPE_stride, int PE_size, long *pSync),                            \
+      (dest, source, nelems, PE_start, logPE_stride, PE_size, pSync), -1,      \
+      nelems *(SIZE / 8) * PE_size, nelems *(SIZE / 8) * PE_size)              \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size), shmem_alltoalls##SIZE, \
+      (void *dest, const void *source, ptrdiff_t dst, ptrdiff_t sst,           \
+       size_t nelems, int PE_start, int logPE_stride, int PE_size,             \
+       long *pSync),                                                           \
+      (dest, source, dst, sst, nelems, PE_start, logPE_stride, PE_size,        \
+       pSync),                                                                 \
+      -1, nelems *(SIZE / 8) * PE_size, nelems *(SIZE / 8) * PE_size)          \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size), shmem_broadcast##SIZE, \
+      (void *dest, const void *source, size_t nelems, int PE_root,             \
+       int PE_start, int logPE_stride, int PE_size, long *pSync),              \
+      (dest, source, nelems, PE_root, PE_start, logPE_stride, PE_size,         \
+       pSync),                                                                 \
+      PE_root, (_osh_pe_id == PE_root ? 0 : nelems *(SIZE / 8)),               \
+      (_osh_pe_id == PE_root ? nelems *(SIZE / 8) : 0))                        \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size), shmem_collect##SIZE,   \
+      (void *dest, const void *source, size_t nelems, int PE_start,            \
+       int logPE_stride, int PE_size, long *pSync),                            \
+      (dest, source, nelems, PE_start, logPE_stride, PE_size, pSync), -1, 0,   \
+      nelems *(SIZE / 8))                                                      \
+  WRAP_CALL_TEAM_VOID(                                                         \
+      _osh_active_set(PE_start, logPE_stride, PE_size), shmem_fcollect##SIZE,  \
+      (void *dest, const void *source, size_t nelems, int PE_start,            \
+       int logPE_stride, int PE_size, long *pSync),                            \
+      (dest, source, nelems, PE_start, logPE_stride, PE_size, pSync), -1,      \
+      nelems *(SIZE / 8) * PE_size, nelems *(SIZE / 8))
+
+// the wrapped functions by class. the class names are what OSH_TRACE_FUNCS
+// and friends match against, see _osh_class_names
+
+// puts and gets of every flavour, including put_signal
+#define _OSH_RMA_FUNCTIONS                                                     \
+  SHMEM_STANDARD_RMA_TYPE_TABLE(SHMEM_RMA_HELPER)                              \
+  SHMEM_STANDARD_RMA_TYPE_TABLE(SHMEM_CTX_RMA_HELPER)                          \
+  SHMEM_SIZED_TYPE_TABLE(SHMEM_SIZED_RMA_HELPER)                               \
+  SHMEM_STANDARD_RMA_TYPE_TABLE(SHMEM_SIGNAL_HELPER)                           \
+  SHMEM_SIZED_TYPE_TABLE(SHMEM_SIZED_SIGNAL_HELPER)                            \
+  SHMEM_MEM_RMA_HELPER()
+
+// atomics
+#define _OSH_AMO_FUNCTIONS                                                     \
+  SHMEM_EXTENDED_AMO_TYPE_TABLE(SHMEM_AMO_HELPER)                              \
+  SHMEM_STANDARD_AMO_TYPE_TABLE(SHMEM_AMO_ARITH_HELPER)                        \
+  SHMEM_BITWISE_AMO_TYPE_TABLE(SHMEM_AMO_BITWISE_HELPER)                       \
+  SHMEM_EXTENDED_AMO_TYPE_TABLE(SHMEM_CTX_AMO_HELPER)                          \
+  SHMEM_STANDARD_AMO_TYPE_TABLE(SHMEM_CTX_AMO_ARITH_HELPER)                    \
+  SHMEM_BITWISE_AMO_TYPE_TABLE(SHMEM_CTX_AMO_BITWISE_HELPER)
+
+// reductions, broadcasts, alltoall[s] and [f]collect
+#define _OSH_COLLECTIVE_FUNCTIONS                                              \
+  SHMEM_TO_ALL_BITWISE_TYPE_TABLE(SHMEM_TO_ALL_BITWISE_HELPER)                 \
+  SHMEM_TO_ALL_MINMAX_TYPE_TABLE(SHMEM_TO_ALL_MINMAX_HELPER)                   \
+  SHMEM_TO_ALL_ARITH_TYPE_TABLE(SHMEM_TO_ALL_ARITH_HELPER)                     \
+  SHMEM_REDUCE_BITWISE_TYPE_TABLE(SHMEM_REDUCE_BITWISE_HELPER)                 \
+  SHMEM_REDUCE_MINMAX_TYPE_TABLE(SHMEM_REDUCE_MINMAX_HELPER)                   \
+  SHMEM_REDUCE_ARITH_TYPE_TABLE(SHMEM_REDUCE_ARITH_HELPER)                     \
+  SHMEM_STANDARD_RMA_TYPE_TABLE(SHMEM_COLLECTIVE_HELPER)                       \
+  SHMEM_MEM_COLLECTIVE_HELPER()                                                \
+  SHMEM_ACTIVE_SET_COLLECTIVE_HELPER(32)                                       \
+  SHMEM_ACTIVE_SET_COLLECTIVE_HELPER(64)
+
+// barriers, fence and quiet, point-to-point waits, signals and locks
+#define _OSH_SYNC_FUNCTIONS                                                    \
+  SHMEM_PT2PT_SYNC_TYPE_TABLE(SHMEM_PT2PT_SYNC_HELPER)                         \
+  WRAP_CALL_VOID(shmem_barrier_all, (void), (), -1, 0, 0)                      \
+  WRAP_CALL_TEAM_VOID(_osh_active_set(PE_start, logPE_stride, PE_size),        \
+                      shmem_barrier,                                           \
+                      (int PE_start, int logPE_stride, int PE_size,            \
+                       long *pSync),                                           \
+                      (PE_start, logPE_stride, PE_size, pSync), -1, 0, 0)      \
+  WRAP_CALL_VOID(shmem_sync_all, (void), (), -1, 0, 0)                         \
+  WRAP_CALL_TEAM_VOID(_osh_active_set(PE_start, logPE_stride, PE_size),        \
+                      shmem_sync,                                              \
+                      (int PE_start, int logPE_stride, int PE_size,            \
+                       long *pSync),                                           \
+                      (PE_start, logPE_stride, PE_size, pSync), -1, 0, 0)      \
+  WRAP_CALL_TEAM_RET(_osh_team_of(team), int, shmem_team_sync,                 \
+                     (shmem_team_t team), (team), -1, 0, 0)                    \
+  WRAP_CALL_VOID(shmem_fence, (void), (), -1, 0, 0)                            \
+  WRAP_CALL_VOID(shmem_quiet, (void), (), -1, 0, 0)                            \
+  WRAP_CALL_VOID(shmem_ctx_fence, (shmem_ctx_t ctx), (ctx), -1, 0, 0)          \
+  WRAP_CALL_VOID(shmem_ctx_quiet, (shmem_ctx_t ctx), (ctx), -1, 0, 0)          \
+  WRAP_CALL_VOID(shmem_set_lock, (long *lock), (lock), -1, 0, 0)               \
+  WRAP_CALL_VOID(shmem_clear_lock, (long *lock), (lock), -1, 0, 0)             \
+  WRAP_CALL_RET(int, shmem_test_lock, (long *lock), (lock), -1, 0, 0)          \
+  WRAP_CALL_RET(uint64_t, shmem_signal_fetch, (const uint64_t *sig_addr),      \
+                (sig_addr), -1, 0, 0)                                          \
+  WRAP_CALL_RET(uint64_t, shmem_signal_wait_until,                             \
+                (uint64_t * sig_addr, int cmp, uint64_t cmp_value),            \
+                (sig_addr, cmp, cmp_value), -1, 0, 0)
+
+// the symmetric heap
+#define _OSH_MEMORY_FUNCTIONS                                                  \
+  WRAP_CALL_RET(void *, shmem_malloc, (size_t size), (size), -1, 0, size)      \
+  WRAP_CALL_RET(void *, shmem_calloc, (size_t count, size_t size),             \
+                (count, size), -1, 0, count *size)                             \
+  WRAP_CALL_RET(void *, shmem_realloc, (void *ptr, size_t size), (ptr, size),  \
+                -1, 0, size)                                                   \
+  WRAP_CALL_RET(void *, shmem_align, (size_t alignment, size_t size),          \
+                (alignment, size), -1, 0, size)                                \
+  WRAP_CALL_RET(void *, shmem_malloc_with_hints, (size_t size, long hints),    \
+                (size, hints), -1, 0, size)                                    \
+  WRAP_CALL_VOID(shmem_free, (void *ptr), (ptr), -1, 0, 0)
+
+// queries, teams and contexts
+#define _OSH_SETUP_FUNCTIONS                                                   \
+  WRAP_CALL_RET(int, shmem_ctx_create, (long options, shmem_ctx_t *ctx),       \
+                (options, ctx), -1, 0, 0)                                      \
+  WRAP_CALL_VOID(shmem_ctx_destroy, (shmem_ctx_t ctx), (ctx), -1, 0, 0)        \
+  WRAP_CALL_RET(int, shmem_team_create_ctx,                                    \
+                (shmem_team_t team, long options, shmem_ctx_t *ctx),           \
+                (team, options, ctx), -1, 0, 0)                                \
+  WRAP_CALL_RET(int, shmem_ctx_get_team,                                       \
+                (shmem_ctx_t ctx, shmem_team_t *team), (ctx, team), -1, 0,     \
+                0)                                                             \
+  WRAP_CALL_RET(int, shmem_team_my_pe, (shmem_team_t team), (team), -1, 0, 0)  \
+  WRAP_CALL_RET(int, shmem_team_n_pes, (shmem_team_t team), (team), -1, 0, 0)  \
+  WRAP_CALL_RET(int, shmem_team_get_config,                                    \
+                (shmem_team_t team, long config_mask,                          \
+                 shmem_team_config_t *config),                                 \
+                (team, config_mask, config), -1, 0, 0)                         \
+  WRAP_CALL_RET(int, shmem_team_translate_pe,                                  \
+                (shmem_team_t src_team, int src_pe, shmem_team_t dest_team),   \
+                (src_team, src_pe, dest_team), -1, 0, 0)                       \
+  WRAP_CALL_RET(int, shmem_team_split_strided,                                 \
+                (shmem_team_t parent_team, int start, int stride, int size,    \
+                 const shmem_team_config_t *config, long config_mask,          \
+                 shmem_team_t *new_team),                                      \
+                (parent_team, start, stride, size, config, config_mask,        \
+                 new_team),                                                    \
+                -1, 0, 0)                                                      \
+  WRAP_CALL_RET(int, shmem_team_split_2d,                                      \
+                (shmem_team_t parent_team, int xrange,                         \
+                 const shmem_team_config_t *xaxis_config, long xaxis_mask,     \
+                 shmem_team_t *xaxis_team,                                     \
+                 const shmem_team_config_t *yaxis_config, long yaxis_mask,     \
+                 shmem_team_t *yaxis_team),                                    \
+                (parent_team, xrange, xaxis_config, xaxis_mask, xaxis_team,    \
+                 yaxis_config, yaxis_mask, yaxis_team),                        \
+                -1, 0, 0)                                                      \
+  WRAP_CALL_VOID(shmem_team_destroy, (shmem_team_t team), (team), -1, 0, 0)    \
+  WRAP_CALL_RET(int, shmem_my_pe, (void), (), -1, 0, 0)                        \
+  WRAP_CALL_RET(int, shmem_n_pes, (void), (), -1, 0, 0)                        \
+  WRAP_CALL_VOID(shmem_query_thread, (int *provided), (provided), -1, 0, 0)
+
+// every wrapped function, in function id order. expanded to build the id
+// enum and the per-function tables; the wrappers themselves are expanded a
+// class at a time at the bottom of this file
+#define _OSH_WRAPPED_FUNCTIONS                                                 \
+  _OSH_RMA_FUNCTIONS                                                           \
+  _OSH_AMO_FUNCTIONS                                                           \
+  _OSH_COLLECTIVE_FUNCTIONS                                                    \
+  _OSH_SYNC_FUNCTIONS                                                          \
+  _OSH_MEMORY_FUNCTIONS                                                        \
+  _OSH_SETUP_FUNCTIONS
+
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)              \
+  _OSH_FN_##FN_NAME,
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)     \
+  _OSH_FN_##FN_NAME,
+
+// nbi_complete is not a real function: one is logged per nbi operation
+// when the quiet or barrier that completes it returns. neither is heap_live,
+// the symmetric heap's live bytes after each allocation or free, nor
+// collective_team, the team of the collective logged right after it
+enum _osh_fn_id {
+  _OSH_FN_shmem_init,
+  _OSH_FN_shmem_init_thread,
+  _OSH_FN_shmem_finalize,
+  _OSH_WRAPPED_FUNCTIONS _OSH_FN_nbi_complete,
+  _OSH_FN_heap_live,
+  _OSH_FN_collective_team,
+  _OSH_FN_COUNT
+};
+
+#undef WRAP_CALL_VOID
+#undef WRAP_CALL_RET
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX) #FN_NAME,
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)     \
+  #FN_NAME,
+
+static const char *const _osh_fn_names[_OSH_FN_COUNT] = {
+    "shmem_init", "shmem_init_thread", "shmem_finalize",
+    _OSH_WRAPPED_FUNCTIONS "nbi_complete", "heap_live", "collective_team"};
+
+#undef WRAP_CALL_VOID
+#undef WRAP_CALL_RET
+
+// 1 for the functions whose name ends in _nbi
+#define _OSH_IS_NBI(S)                                                         \
+  (sizeof(S) > 5 && (S)[sizeof(S) - 5] == '_' && (S)[sizeof(S) - 4] == 'n' &&  \
+   (S)[sizeof(S) - 3] == 'b' && (S)[sizeof(S) - 2] == 'i')
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)              \
+  _OSH_IS_NBI(#FN_NAME),
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)     \
+  _OSH_IS_NBI(#FN_NAME),
+
+static const unsigned char _osh_fn_nbi[_OSH_FN_COUNT] = {
+    0, 0, 0, _OSH_WRAPPED_FUNCTIONS 0, 0, 0};
+
+#undef WRAP_CALL_VOID
+#undef WRAP_CALL_RET
+#undef _OSH_IS_NBI
+
+enum _osh_fn_class {
+  _OSH_CLASS_RMA,
+  _OSH_CLASS_AMO,
+  _OSH_CLASS_COLLECTIVE,
+  _OSH_CLASS_SYNC,
+  _OSH_CLASS_MEMORY,
+  _OSH_CLASS_SETUP,
+  _OSH_CLASS_COUNT
+};
+
+static const char *const _osh_class_names[_OSH_CLASS_COUNT] = {
+    "rma", "amo", "collective", "sync", "memory", "setup"};
+
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX) +1
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX) +1
+
+// the classes are contiguous in function id order, each ends where the next
+// one starts
+enum {
+  _OSH_FN_FIRST_WRAPPED = _OSH_FN_shmem_finalize + 1,
+  _OSH_FN_END_RMA = _OSH_FN_FIRST_WRAPPED _OSH_RMA_FUNCTIONS,
+  _OSH_FN_END_AMO = _OSH_FN_END_RMA _OSH_AMO_FUNCTIONS,
+  _OSH_FN_END_COLLECTIVE = _OSH_FN_END_AMO _OSH_COLLECTIVE_FUNCTIONS,
+  _OSH_FN_END_SYNC = _OSH_FN_END_COLLECTIVE _OSH_SYNC_FUNCTIONS,
+  _OSH_FN_END_MEMORY = _OSH_FN_END_SYNC _OSH_MEMORY_FUNCTIONS,
+};
+
+#undef WRAP_CALL_VOID
+#undef WRAP_CALL_RET
+
+// shmem_init, shmem_init_thread and shmem_finalize are setup too
+static inline int _osh_fn_class(uint32_t func_id) {
+  if (func_id < _OSH_FN_FIRST_WRAPPED) {
+    return _OSH_CLASS_SETUP;
+  } else if (func_id < _OSH_FN_END_RMA) {
+    return _OSH_CLASS_RMA;
+  } else if (func_id < _OSH_FN_END_AMO) {
+    return _OSH_CLASS_AMO;
+  } else if (func_id < _OSH_FN_END_COLLECTIVE) {
+    return _OSH_CLASS_COLLECTIVE;
+  } else if (func_id < _OSH_FN_END_SYNC) {
+    return _OSH_CLASS_SYNC;
+  } else if (func_id < _OSH_FN_END_MEMORY) {
+    return _OSH_CLASS_MEMORY;
+  }
+  return _OSH_CLASS_SETUP;
+}
+
+// binary trace layout (pperf.NNN.bin): a sequence of blocks, each a
+// struct _osh_block followed by `size` payload bytes. a PE always starts with
+// a header and a function name block and ends with a trailer; stack and event
+// blocks are appended in between every time the in-memory buffer fills up.
+// bin_to_csv.py turns this back into the classic pperf.NNN.csv
+//
+// a mapped trace (OSH_TRACE_MMAP=1) has a segments block after the function
+// names. from `first` on the file is cut into segments of `size` bytes, each
+// holding one stacks or events block that is filled in place. the rest of a
+// segment is zero: a reader skips to the next segment on a zero block type
+#define _OSH_TRACE_MAGIC "OSHTRACE"
+#define _OSH_TRACE_VERSION 5
+
+enum {
+  _OSH_BLOCK_HEADER = 1,   // struct _osh_header
+  _OSH_BLOCK_FUNCS = 2,    // NUL terminated function names, in id order
+  _OSH_BLOCK_STACKS = 3,   // { u32 id, u32 depth, u64 frames[depth] }...
+  _OSH_BLOCK_EVENTS = 4,   // struct _osh_event[]
+  _OSH_BLOCK_TRAILER = 5,  // struct _osh_trailer
+  _OSH_BLOCK_PAD = 6,      // skipped, keeps O_DIRECT writes aligned
+  _OSH_BLOCK_SEGMENTS = 7, // struct _osh_segments
+  _OSH_BLOCK_MODULES = 8,  // { struct _osh_module, path, build id }...
+};
+
+// PE 0's Time minus ours, both in ns: Time + shift puts our events on PE 0's
+// timeline. two of these, from init and finalize, also give the drift
+struct _osh_clock_shift {
+  int64_t shift;
+  uint64_t at;  // our Time when it was measured
+  uint64_t rtt; // of the ping-pong it came from, 0 if never measured
+};
+
+struct _osh_block {
+  uint16_t type;
+  uint16_t tid; // thread that logged the block, 0 for per-PE blocks
+  int32_t pe;
+  uint64_t size;
+};
+
+struct _osh_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t event_size;
+  int32_t pe;
+  int32_t n_pes;
+  uint64_t tick_origin; // ticks at the end of pshmem_init, Time = 0
+  double ns_per_tick;
+  uint64_t origin_ns; // CLOCK_MONOTONIC at tick_origin
+  uint64_t slide;
+  char host[64];
+  struct _osh_clock_shift clock; // measured in shmem_init
+};
+
+struct _osh_event {
+  uint64_t start; // ticks
+  uint64_t duration;
+  uint64_t bytes_rx;
+  uint64_t bytes_tx;
+  uint32_t func_id;
+  int32_t target_pe;
+  uint32_t stack_id;
+  uint32_t aux; // function specific, 0 if unused
+};
+
+struct _osh_segments {
+  uint64_t first;
+  uint64_t size;
+};
+
+// an object loaded in the process, from dl_iterate_phdr. followed by its
+// path and build id, and padded to 8 bytes. a frame symbolizes as
+// (build id, address - bias) no matter where the object was loaded
+struct _osh_module {
+  uint64_t bias; // dlpi_addr, added to the object's own addresses
+  uint64_t start;
+  uint64_t end;
+  uint32_t path_len; // including the NUL
+  uint32_t build_id_len;
+};
+
+struct _osh_trailer {
+  uint64_t events;
+  uint64_t dropped;
+  uint64_t end_tick;
+  struct _osh_clock_shift clock; // measured in shmem_finalize
+};
+
+#define _OSH_MAX_FRAMES 32
+#define _OSH_DEFAULT_FRAMES 10
+#define _OSH_NO_STACK UINT32_MAX
+#define _OSH_DEFAULT_BUFFER_EVENTS 65536
+#define _OSH_STACK_BUFFER_ENTRIES 4096
+#define _OSH_STACK_TABLE_SLOTS 4096
+
+// call stacks are interned: events only carry a stack id, and each unique
+// stack is written to the trace once, the first time it is seen. the table is
+// open addressing over the frame hash, the frames themselves live in `words`
+// as { depth, frames[depth] } at offsets[id] so lookups can compare exactly
+struct _osh_stack_slot {
+  uint64_t hash; // 0 = empty
+  uint32_t id;
+};
+
+struct _osh_stack_table {
+  struct _osh_stack_slot *slots;
+  uint32_t mask;
+  uint32_t count;
+  uint32_t *offsets;
+  uint64_t *words;
+  size_t n_words;
+  size_t cap_words;
+};
+
+// events and newly interned stacks are staged in preallocated arrays that are
+// written out as one block each when either fills up. both arrays keep room
+// for their block header right in front of them so a flush is a single write()
+struct _osh_buffer {
+  struct _osh_block *events_blk;
+  struct _osh_event *events;
+  uint32_t n_events;
+  uint32_t cap_events;
+  struct _osh_block *stacks_blk;
+  uint64_t *stacks;
+  uint32_t n_stack_words;
+  uint32_t cap_stack_words;
+  uint32_t tid;
+  int in_flight;            // queued for or being written by the writer
+  struct _osh_buffer *next; // writer queue
+};
+
+#define _OSH_DIRECT_ALIGN 4096
+
+// OSH_TRACE_ASYNC=1: wrapped calls only fill buffers. a full buffer is queued
+// for the writer thread and the thread's spare one takes its place. if the
+// writer still holds the spare, the event is dropped and counted instead of
+// blocking
+struct _osh_writer {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct _osh_buffer *head;
+  struct _osh_buffer *tail;
+  int stop;
+  int direct; // the trace fd is O_DIRECT, blocks get padded
+};
+
+// OSH_TRACE_MMAP=1: the trace file is mapped and each thread's buffer is a
+// segment of it, so a record is in the page cache as soon as it is logged
+// and survives the process crashing. address space for the largest file
+// allowed is reserved up front; the file itself is grown in chunks as
+// threads claim segments, the only syscalls left
+#define _OSH_MMAP_CHUNK (64ull << 20)
+#define _OSH_MMAP_DEFAULT_MAX (64ull << 30)
+
+struct _osh_mapping {
+  char *base;           // NULL unless the trace is mapped
+  uint64_t reserved;    // bytes of address space at base
+  uint64_t size;        // current file size
+  uint64_t segment;     // bytes per segment
+  pthread_mutex_t lock; // serializes growing the file
+};
+
+// OSH_TRACE_MODE bits. bin and csv are the per-event sinks and exclusive,
+// stats and summary can go along with either or on their own
+enum {
+  _OSH_TRACE_OFF = 0,
+  _OSH_TRACE_BIN = 1,
+  _OSH_TRACE_CSV = 2,
+  _OSH_TRACE_STATS = 4,
+  _OSH_TRACE_SUMMARY = 8,
+  _OSH_TRACE_COMM = 16,
+  _OSH_TRACE_HEAP = 32,
+  _OSH_TRACE_LIVE = 64,
+};
+
+#define _OSH_HIST_BUCKETS 256
+#define _OSH_STATS_SLOTS 256
+
+// aggregate counters per (function, target PE), with a log-linear latency
+// histogram of 4 buckets per power of two ticks. written to pstats.NNN.csv
+// at finalize, so memory stays constant and there is no I/O while running
+struct _osh_stat {
+  uint64_t key; // (func_id + 1) << 32 | (uint32_t)target_pe, 0 = empty
+  uint64_t calls;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  uint64_t bytes_rx;
+  uint64_t bytes_tx;
+  uint64_t hist[_OSH_HIST_BUCKETS];
+};
+
+struct _osh_stats_table {
+  struct _osh_stat *slots;
+  uint32_t mask;
+  uint32_t count;
+  uint32_t hint[_OSH_FN_COUNT]; // slot last used by each function
+};
+
+// PE-to-PE traffic, one row of counters per target PE. message sizes are
+// bucketed by powers of 8: <=8, <=64, ... <=2M, and larger
+#define _OSH_COMM_SIZE_BUCKETS 8
+
+enum {
+  _OSH_COMM_TX,
+  _OSH_COMM_RX,
+  _OSH_COMM_MSGS,
+  _OSH_COMM_SIZES,
+  _OSH_COMM_FIELDS = _OSH_COMM_SIZES + _OSH_COMM_SIZE_BUCKETS,
+};
+
+// an issued nbi operation waiting for the quiet or barrier that completes it
+struct _osh_nbi_op {
+  uint64_t start;
+  uint64_t bytes_rx;
+  uint64_t bytes_tx;
+  int32_t target_pe;
+  uint32_t func_id;
+  uint32_t stack_id;
+  uint32_t recorded; // the issuing call's event was kept
+};
+
+#define _OSH_NBI_INITIAL_OPS 1024
+
+struct _osh_nbi_list {
+  struct _osh_nbi_op *ops;
+  uint32_t count;
+  uint32_t cap;
+};
+
+// the symmetric heap: every live allocation by address, open addressing
+// with linear probing, and the call site that made it. call sites are
+// interned by their frames in a stack table of their own. shmem_malloc and
+// friends are collective and slow, so one lock for the whole PE is fine
+#define _OSH_HEAP_SLOTS 1024
+
+struct _osh_alloc {
+  uint64_t addr; // 0 = empty
+  uint64_t size;
+  uint32_t site;
+};
+
+// indexed by the site's stack id
+struct _osh_heap_site {
+  uint64_t live; // bytes
+  uint64_t max_live;
+  uint32_t live_allocs;
+  uint32_t allocs;
+};
+
+struct _osh_heap {
+  pthread_mutex_t lock;
+  struct _osh_alloc *allocs;
+  uint32_t mask;
+  uint32_t count;
+  struct _osh_stack_table site_stacks;
+  struct _osh_heap_site *sites;
+  uint32_t cap_sites;
+  uint64_t live;
+  uint64_t peak;
+  uint64_t n_allocs;
+  uint64_t untracked; // allocations left out once the table couldn't grow
+};
+
+// a team or active set as each of its PEs sees it: the world PE of its first
+// member, the world PE stride between members and its size. the world is
+// all zeros, a team that isn't valid has start -1
+struct _osh_team {
+  int start;
+  int stride;
+  int size;
+};
+
+#define _OSH_TEAM_SEQ_SLOTS 64
+
+// sequence numbers of the collectives on teams other than the world, by
+// function and team. open addressing, at most 3/4 full
+struct _osh_team_seq {
+  struct _osh_team team; // size 0 = empty
+  uint32_t func_id;
+  uint32_t seq;
+};
+
+struct _osh_team_seqs {
+  pthread_mutex_t lock;
+  struct _osh_team_seq *slots;
+  uint32_t mask;
+  uint32_t count;
+};
+
+// per function row of the job summary, reduced over all PEs in ns
+enum {
+  _OSH_SUM_CALLS,
+  _OSH_SUM_TOTAL,
+  _OSH_SUM_RX,
+  _OSH_SUM_TX,
+  _OSH_SUM_PES,
+  _OSH_SUM_HIST,
+  _OSH_SUM_FIELDS = _OSH_SUM_HIST + _OSH_HIST_BUCKETS,
+};
+
+// OSH_TRACE_CLOCK, where event timestamps come from. the tsc (cntvct_el0 on
+// arm) is read raw and converted to time only offline, using a ratio
+// calibrated against CLOCK_MONOTONIC during shmem_init
+enum {
+  _OSH_CLOCK_MONOTONIC = 0,
+  _OSH_CLOCK_TSC = 1,
+};
+
+#define _OSH_CALIBRATION_NS 10000000
+#define _OSH_SYNC_ROUNDS 16
+
+struct _osh_clock_sample {
+  uint64_t ticks;
+  uint64_t ns;
+};
+
+// live telemetry (OSH_TRACE_MODE=live): a POSIX shared memory segment per
+// node, osh-<uid>-<pid of PE 0>, with a slot per PE on the node that its
+// wrappers keep current. nothing but stores into the mapping after
+// shmem_init. readers like osh-top copy a slot and retry if its seq was odd
+// or changed meanwhile. the segment is a header, the slots from
+// slots_offset, and the function names, NUL separated, from names_offset
+#define _OSH_LIVE_MAGIC "OSHLIVE"
+#define _OSH_LIVE_VERSION 1
+#define _OSH_LIVE_SLOTS_OFFSET 64
+
+// orders stores into the segment for readers in other processes. tsan can't
+// see those and gcc warns about fences under it
+#ifdef __SANITIZE_THREAD__
+#define _OSH_LIVE_FENCE() ((void)0)
+#else
+#define _OSH_LIVE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+struct _osh_live_header {
+  char magic[8]; // written last
+  uint32_t version;
+  uint32_t n_slots; // PEs on this node
+  uint32_t slot_size;
+  uint32_t slots_offset;
+  uint32_t n_classes; // see _osh_class_names
+  uint32_t names_offset;
+  uint32_t names_size;
+  int32_t n_pes; // in the job
+};
+
+struct _osh_live_class {
+  uint64_t calls;
+  uint64_t bytes; // sent and received
+  uint64_t ticks; // inside the calls
+};
+
+enum {
+  _OSH_LIVE_EMPTY = 0,
+  _OSH_LIVE_RUNNING = 1,
+  _OSH_LIVE_DONE = 2, // tracing stopped, normally in shmem_finalize
+};
+
+// ticks are the trace's, clock_base pairs them with CLOCK_MONOTONIC
+struct _osh_live_slot {
+  uint64_t seq; // odd while a thread of the PE updates the slot
+  int32_t pe;
+  int32_t pid;
+  uint32_t state;
+  uint32_t in_flight; // calls entered that haven't returned yet
+  uint32_t func_id;   // the call entered last
+  uint32_t reserved;
+  uint64_t call_start; // when it was entered
+  uint64_t last_return;
+  struct _osh_clock_sample clock_base;
+  double ns_per_tick;
+  struct _osh_live_class classes[_OSH_CLASS_COUNT];
+} __attribute__((aligned(64)));
+
+struct _osh_live {
+  char *base;
+  size_t size;
+  struct _osh_live_slot *slot; // this PE's
+  int leader;                  // created the segment, unlinks it
+  char name[64];
+};
+
+// OSH_TRACE_STACK, how much of the call stack each event records
+enum {
+  _OSH_STACK_BACKTRACE = 0, // glibc backtrace(), full but slow
+  _OSH_STACK_CALLER = 1,    // just the call site of the shmem_* function
+  _OSH_STACK_FP = 2,        // frame pointer walk, needs frame pointers
+  _OSH_STACK_OFF = 3,
+};
+
+// everything a thread logs into, so wrapped calls from different threads
+// never touch the same memory. registered on a thread's first wrapped call by
+// pushing onto _osh_threads, and only freed when tracing stops
+struct _osh_thread {
+  struct _osh_thread *next;
+  uint32_t tid; // 0 is the thread that called shmem_init
+  struct _osh_buffer buffers[2];
+  struct _osh_buffer *buffer;
+  struct _osh_stack_table stacks; // stack ids are per thread
+  struct _osh_stats_table stats;
+  struct _osh_nbi_list nbi;
+  uint64_t *comm;
+  uint32_t skip[_OSH_FN_COUNT]; // calls until the next sampled one
+  uintptr_t stack_lo;           // the thread's stack, 0 if unknown
+  uintptr_t stack_hi;
+};
+
+// what _osh_filter has turned on, see _osh_parse_filters
+enum {
+  _OSH_FILTER_TIME = 1,     // OSH_TRACE_WINDOW
+  _OSH_FILTER_BARRIERS = 2, // OSH_TRACE_BARRIER_WINDOW
+  _OSH_FILTER_EVENTS = 8,   // OSH_TRACE_SAMPLE, OSH_TRACE_MIN_DURATION
+};
+
+#if defined(SHMEM_PERF_SETUP) && !defined(_SHMEM_INSTANTIATED)
+FILE *_osh_profile_log = NULL;
+int _osh_pe_id = -1;
+uint64_t _osh_start;
+int _osh_trace_mode = _OSH_TRACE_OFF;
+int _osh_summary = 0;
+uint32_t _osh_comm_pes = 0;
+struct _osh_thread *_osh_threads = NULL;
+uint32_t _osh_n_threads = 0;
+__thread struct _osh_thread *_osh_self = NULL;
+int _osh_clock = _OSH_CLOCK_MONOTONIC;
+double _osh_ns_per_tick = 1.0;
+struct _osh_clock_sample _osh_clock_base;
+int _osh_trace_fd = -1;
+int _osh_trace_append = 0;
+uint64_t _osh_trace_offset = 0;
+int _osh_trace_async = 0;
+uint32_t _osh_buffer_events = _OSH_DEFAULT_BUFFER_EVENTS;
+struct _osh_writer _osh_writer;
+struct _osh_mapping _osh_mapping;
+pthread_rwlock_t _osh_sink_lock = PTHREAD_RWLOCK_INITIALIZER;
+int _osh_sink_closed = 0;
+int _osh_stack_mode = _OSH_STACK_BACKTRACE;
+int _osh_stack_depth = _OSH_DEFAULT_FRAMES;
+uint64_t _osh_events_written;
+uint64_t _osh_events_dropped;
+int _osh_filter = 0;
+unsigned char _osh_fn_traced[_OSH_FN_COUNT];
+uint32_t _osh_fn_sample[_OSH_FN_COUNT];
+uint64_t _osh_min_ticks = 0;
+uint64_t _osh_window[2];
+uint64_t _osh_barrier_window[2];
+uint64_t _osh_barriers = 0;
+uint64_t _osh_modules_adds = 0;
+int _osh_sync_rounds = 0;
+struct _osh_clock_shift _osh_shifts[2]; // at init and at finalize
+uint32_t _osh_collective_seq[_OSH_FN_COUNT];
+struct _osh_team_seqs _osh_team_seqs = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0};
+struct _osh_heap _osh_heap;
+struct _osh_live _osh_live;
+#define _SHMEM_INSTANTIATED
+#else
+extern FILE *_osh_profile_log;
+extern int _osh_pe_id;
+extern uint64_t _osh_start;
+extern int _osh_trace_mode;
+extern int _osh_summary;
+extern uint32_t _osh_comm_pes;
+extern struct _osh_thread *_osh_threads;
+extern uint32_t _osh_n_threads;
+extern __thread struct _osh_thread *_osh_self;
+extern int _osh_clock;
+extern double _osh_ns_per_tick;
+extern struct _osh_clock_sample _osh_clock_base;
+extern int _osh_trace_fd;
+extern int _osh_trace_append;
+extern uint64_t _osh_trace_offset;
+extern int _osh_trace_async;
+extern uint32_t _osh_buffer_events;
+extern struct _osh_writer _osh_writer;
+extern struct _osh_mapping _osh_mapping;
+extern pthread_rwlock_t _osh_sink_lock;
+extern int _osh_sink_closed;
+extern int _osh_stack_mode;
+extern int _osh_stack_depth;
+extern uint64_t _osh_events_written;
+extern uint64_t _osh_events_dropped;
+extern int _osh_filter;
+extern unsigned char _osh_fn_traced[_OSH_FN_COUNT];
+extern uint32_t _osh_fn_sample[_OSH_FN_COUNT];
+extern uint64_t _osh_min_ticks;
+extern uint64_t _osh_window[2];
+extern uint64_t _osh_barrier_window[2];
+extern uint64_t _osh_barriers;
+extern uint64_t _osh_modules_adds;
+extern int _osh_sync_rounds;
+extern struct _osh_clock_shift _osh_shifts[2];
+extern uint32_t _osh_collective_seq[_OSH_FN_COUNT];
+extern struct _osh_team_seqs _osh_team_seqs;
+extern struct _osh_heap _osh_heap;
+extern struct _osh_live _osh_live;
+#endif
+
+_OSH_INLINE uint64_t _osh_mono_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+_OSH_INLINE uint64_t _osh_get_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (_osh_clock == _OSH_CLOCK_TSC) {
+    unsigned int aux;
+    return __rdtscp(&aux);
+  }
+#elif defined(__aarch64__)
+  if (_osh_clock == _OSH_CLOCK_TSC) {
+    uint64_t v;
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(v) : : "memory");
+    return v;
+  }
+#endif
+  return _osh_mono_ns();
+}
+
+static inline double _osh_ticks_to_sec(int64_t ticks) {
+  return (double)ticks * _osh_ns_per_tick / 1e9;
+}
+
+// the tightest of a few back to back (ticks, CLOCK_MONOTONIC) pairs
+static _OSH_COLD void _osh_clock_sample(struct _osh_clock_sample *out) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 5; i++) {
+    uint64_t t0 = _osh_get_ticks();
+    uint64_t ns = _osh_mono_ns();
+    uint64_t t1 = _osh_get_ticks();
+    if (t1 - t0 < best) {
+      best = t1 - t0;
+      out->ticks = t0 + (t1 - t0) / 2;
+      out->ns = ns;
+    }
+  }
+}
+
+static _OSH_COLD int _osh_tsc_usable(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  // needs an invariant tsc, one that ticks at a constant rate in all states
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+  return (edx >> 8) & 1;
+#elif defined(__aarch64__)
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+// OSH_TRACE_CLOCK=tsc (default where usable) | monotonic. takes the first
+// calibration sample, _osh_clock_calibrate takes the second
+static _OSH_COLD void _osh_clock_init(void) {
+  const char *env = getenv("OSH_TRACE_CLOCK");
+  int want_tsc = !env || strcmp(env, "tsc") == 0;
+  _osh_clock = want_tsc && _osh_tsc_usable() ? _OSH_CLOCK_TSC
+                                             : _OSH_CLOCK_MONOTONIC;
+  _osh_ns_per_tick = 1.0;
+  _osh_clock_sample(&_osh_clock_base);
+}
+
+// the interval is normally all of pshmem_init, we only wait out the rest of
+// _OSH_CALIBRATION_NS if that was quicker
+static _OSH_COLD void _osh_clock_calibrate(void) {
+  if (_osh_clock != _OSH_CLOCK_TSC) {
+    return;
+  }
+  struct _osh_clock_sample end;
+  do {
+    _osh_clock_sample(&end);
+  } while (end.ns - _osh_clock_base.ns < _OSH_CALIBRATION_NS);
+  _osh_ns_per_tick = (double)(end.ns - _osh_clock_base.ns) /
+                     (double)(end.ticks - _osh_clock_base.ticks);
+}
+
+// CLOCK_MONOTONIC at the given tick count
+static inline uint64_t _osh_ticks_to_ns(uint64_t ticks) {
+  return _osh_clock_base.ns +
+         (uint64_t)((double)(int64_t)(ticks - _osh_clock_base.ticks) *
+                    _osh_ns_per_tick);
+}
 
-WRAP_CALL_VOID(shmem_broadcast64,
-               (void *dest, const void *source, size_t nelems, int PE_root,
-                int PE_start, int logPE_stride, int PE_size, long *pSync),
-               (dest, source, nelems, PE_root, PE_start, logPE_stride, PE_size,
-                pSync),
-               PE_root, (_osh_pe_id == PE_root ? 0 : nelems * 8),
-               (_osh_pe_id == PE_root ? nelems * 8 : 0))
+// ns since our Time origin, the end of pshmem_init
+static inline int64_t _osh_time_ns(void) {
+  return (int64_t)((double)(int64_t)(_osh_get_ticks() - _osh_start) *
+                   _osh_ns_per_tick);
+}
+
+// collective. PE 0 pings every other PE in turn through a symmetric word and
+// the PE answers with its Time. the fastest round trip of _osh_sync_rounds
+// gives the shift, assuming both legs took equally long. PE 0 drives it so
+// only one PE is ever talking to it
+static _OSH_COLD void _osh_clock_sync(struct _osh_clock_shift *out) {
+  memset(out, 0, sizeof(*out));
+  int n_pes = pshmem_n_pes();
+  if (n_pes < 2) {
+    return;
+  }
+  // ping, pong, then PE 0 puts the result
+  uint64_t *word = (uint64_t *)pshmem_malloc(5 * sizeof(uint64_t));
+  if (!word) {
+    return;
+  }
+  memset(word, 0, 5 * sizeof(uint64_t));
+  pshmem_barrier_all();
+
+  if (_osh_pe_id == 0) {
+    for (int pe = 1; pe < n_pes; pe++) {
+      struct _osh_clock_shift best = {0, 0, UINT64_MAX};
+      for (uint64_t r = 1; r <= (uint64_t)_osh_sync_rounds; r++) {
+        pshmem_uint64_atomic_set(&word[1], UINT64_MAX, 0);
+        int64_t t0 = _osh_time_ns();
+        pshmem_uint64_atomic_set(&word[0], r, pe);
+        pshmem_uint64_wait_until(&word[1], SHMEM_CMP_NE, UINT64_MAX);
+        int64_t t1 = _osh_time_ns();
+        int64_t theirs = (int64_t)pshmem_uint64_atomic_fetch(&word[1], 0);
+        if ((uint64_t)(t1 - t0) < best.rtt) {
+          best.rtt = t1 - t0 > 0 ? (uint64_t)(t1 - t0) : 1;
+          best.shift = t0 + (t1 - t0) / 2 - theirs;
+          best.at = (uint64_t)theirs;
+        }
+      }
+      pshmem_putmem(&word[2], &best, sizeof(best), pe);
+    }
+  } else {
+    for (uint64_t r = 1; r <= (uint64_t)_osh_sync_rounds; r++) {
+      pshmem_uint64_wait_until(&word[0], SHMEM_CMP_EQ, r);
+      pshmem_uint64_atomic_set(&word[1], (uint64_t)_osh_time_ns(), 0);
+    }
+  }
+  pshmem_barrier_all();
+
+  if (_osh_pe_id != 0) {
+    memcpy(out, &word[2], sizeof(*out));
+  }
+  pshmem_free(word);
+}
+
+static const char *const EMPTY_STRING = "";
+
+// frames are written inline as the row's Stacktrace, depth 0 leaves it empty
+static _OSH_COLD void _osh_log_csv(uint32_t tid, uint32_t func_id,
+                                   uint64_t duration, uint64_t start,
+                                   int target_pe, size_t bytes_rx,
+                                   size_t bytes_tx, void *const *frames,
+                                   int depth, char *extra) {
+  if (UNLIKELY(_osh_profile_log == NULL)) {
+    if (_osh_pe_id == -1) {
+      return;
+    }
+
+    char filename[32];
+    snprintf(filename, sizeof(filename), "pperf.%03d.csv", _osh_pe_id);
+
+    _osh_profile_log = fopen(filename, "a");
+    if (!_osh_profile_log) {
+      perror("failed to open log file");
+      return;
+    }
+  }
+
+  // "0x" and 16 digits and a '|' per frame
+  char bt_str[_OSH_MAX_FRAMES * 19 + 1] = "";
+  int offset = 0;
+  for (int i = 0; i < depth; i++) {
+    offset += snprintf(bt_str + offset, sizeof(bt_str) - offset, "%p|",
+                       frames[i]);
+  }
+
+  // a single fprintf, stdio locks the stream so rows from different threads
+  // don't interleave
+  fprintf(_osh_profile_log, "%.9f,%s,%.9f,%d,%zu,%zu,%u,%s,%s\n",
+          _osh_ticks_to_sec((int64_t)(start - _osh_start)),
+          _osh_fn_names[func_id], _osh_ticks_to_sec((int64_t)duration),
+          target_pe, bytes_rx, bytes_tx, tid, bt_str,
+          extra ? extra : EMPTY_STRING);
+}
+
+// threads flush concurrently, so each claims its range of the file up front
+// and writes there. a shared per-node file is O_APPEND instead, where the
+// kernel does the same for every write()
+static inline int _osh_write_all(int fd, const void *data, size_t len) {
+  const char *p = (const char *)data;
+  off_t off = 0;
+  if (!_osh_trace_append) {
+    off = (off_t)__atomic_fetch_add(&_osh_trace_offset, len, __ATOMIC_RELAXED);
+  }
+  while (len > 0) {
+    ssize_t n = _osh_trace_append ? write(fd, p, len) : pwrite(fd, p, len, off);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    off += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+// extends blk..blk+len with a pad block up to the next _OSH_DIRECT_ALIGN
+// boundary. the memory behind the payload must have room for it
+static inline size_t _osh_pad_block(struct _osh_block *blk, size_t len) {
+  size_t padded = (len + sizeof(struct _osh_block) + _OSH_DIRECT_ALIGN - 1) &
+                  ~(size_t)(_OSH_DIRECT_ALIGN - 1);
+  struct _osh_block *pad = (struct _osh_block *)((char *)blk + len);
+  pad->type = _OSH_BLOCK_PAD;
+  pad->tid = blk->tid;
+  pad->pe = _osh_pe_id;
+  pad->size = padded - len - sizeof(*pad);
+  memset(pad + 1, 0, pad->size);
+  return padded;
+}
+
+// taken around whatever adds to the trace file while wrappers run: a flush,
+// a new segment, a modules block. 0 once _osh_exit_flush has finished the
+// file, nothing may be added after that
+static inline int _osh_sink_enter(void) {
+  pthread_rwlock_rdlock(&_osh_sink_lock);
+  if (_osh_sink_closed) {
+    pthread_rwlock_unlock(&_osh_sink_lock);
+    return 0;
+  }
+  return 1;
+}
+
+static inline void _osh_sink_leave(void) {
+  pthread_rwlock_unlock(&_osh_sink_lock);
+}
+
+// blk must be followed by `size` bytes of payload in memory
+static inline int _osh_write_block(struct _osh_block *blk, uint16_t type,
+                                   uint32_t tid, uint64_t size) {
+  blk->type = type;
+  blk->tid = (uint16_t)tid;
+  blk->pe = _osh_pe_id;
+  blk->size = size;
+  size_t len = sizeof(*blk) + size;
+  if (_osh_writer.direct) {
+    len = _osh_pad_block(blk, len);
+  }
+  return _osh_write_all(_osh_trace_fd, blk, len);
+}
+
+// writes out and empties one buffer. runs on the writer thread in async mode
+static _OSH_COLD void _osh_write_buffer(struct _osh_buffer *b) {
+  // stacks go first so a reader has them before the events referencing them.
+  // if they can't be written they stay staged for the next flush, since the
+  // stack table already hands out their ids, and the events are dropped
+  int stacks_failed = 0;
+  if (b->n_stack_words) {
+    stacks_failed =
+        _osh_write_block(b->stacks_blk, _OSH_BLOCK_STACKS, b->tid,
+                         (uint64_t)b->n_stack_words * sizeof(uint64_t)) != 0;
+    if (!stacks_failed) {
+      b->n_stack_words = 0;
+    }
+  }
+  if (b->n_events) {
+    if (stacks_failed ||
+        _osh_write_block(b->events_blk, _OSH_BLOCK_EVENTS, b->tid,
+                         (uint64_t)b->n_events * sizeof(struct _osh_event))) {
+      __atomic_fetch_add(&_osh_events_dropped, b->n_events, __ATOMIC_RELAXED);
+    } else {
+      __atomic_fetch_add(&_osh_events_written, b->n_events, __ATOMIC_RELAXED);
+    }
+    b->n_events = 0;
+  }
+  // nothing committed is left unwritten, see _osh_write_committed
+  __atomic_store_n(&b->stacks_blk->size,
+                   (uint64_t)b->n_stack_words * sizeof(uint64_t),
+                   __ATOMIC_RELEASE);
+  __atomic_store_n(&b->events_blk->size, 0, __ATOMIC_RELEASE);
+}
+
+// claims the next segment of the mapped file for a block of `type`, growing
+// the file if needed. NULL once the file would outgrow the reservation
+static _OSH_COLD struct _osh_block *_osh_mmap_segment(uint16_t type,
+                                                      uint32_t tid) {
+  struct _osh_mapping *m = &_osh_mapping;
+  if (!_osh_sink_enter()) {
+    return NULL;
+  }
+  uint64_t off = __atomic_load_n(&_osh_trace_offset, __ATOMIC_RELAXED);
+  do {
+    if (off + m->segment > m->reserved) {
+      _osh_sink_leave();
+      return NULL;
+    }
+  } while (!__atomic_compare_exchange_n(&_osh_trace_offset, &off,
+                                        off + m->segment, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+
+  uint64_t end = off + m->segment;
+  if (end > __atomic_load_n(&m->size, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&m->lock);
+    if (end > m->size) {
+      uint64_t size = (end + _OSH_MMAP_CHUNK - 1) & ~(_OSH_MMAP_CHUNK - 1);
+      size = size < m->reserved ? size : m->reserved;
+      if (ftruncate(_osh_trace_fd, (off_t)size) != 0) {
+        pthread_mutex_unlock(&m->lock);
+        _osh_sink_leave();
+        return NULL;
+      }
+      __atomic_store_n(&m->size, size, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&m->lock);
+  }
+
+  struct _osh_block *blk = (struct _osh_block *)(m->base + off);
+  blk->tid = (uint16_t)tid;
+  blk->pe = _osh_pe_id;
+  blk->size = 0;
+  __atomic_store_n(&blk->type, type, __ATOMIC_RELEASE);
+  _osh_sink_leave();
+  return blk;
+}
+
+// the mapped counterpart of a flush: whichever of the buffer's events and
+// stacks is full moves on to a fresh segment. what it leaves behind is
+// already in the file
+static _OSH_COLD int _osh_mmap_next(struct _osh_buffer *b) {
+  size_t room = _osh_mapping.segment - sizeof(struct _osh_block);
+  if (b->n_events == b->cap_events) {
+    struct _osh_block *blk = _osh_mmap_segment(_OSH_BLOCK_EVENTS, b->tid);
+    if (!blk) {
+      return 0;
+    }
+    __atomic_fetch_add(&_osh_events_written, b->n_events, __ATOMIC_RELAXED);
+    b->events_blk = blk;
+    b->events = (struct _osh_event *)(blk + 1);
+    b->n_events = 0;
+    b->cap_events = (uint32_t)(room / sizeof(struct _osh_event));
+  }
+  if (b->n_stack_words + 1 + _OSH_MAX_FRAMES > b->cap_stack_words) {
+    struct _osh_block *blk = _osh_mmap_segment(_OSH_BLOCK_STACKS, b->tid);
+    if (!blk) {
+      return 0;
+    }
+    b->stacks_blk = blk;
+    b->stacks = (uint64_t *)(blk + 1);
+    b->n_stack_words = 0;
+    b->cap_stack_words = (uint32_t)(room / sizeof(uint64_t));
+  }
+  return 1;
+}
+
+// empties t's current buffer. returns 0 if it could not be emptied and the
+// event has to be dropped
+static _OSH_COLD int _osh_flush(struct _osh_thread *t) {
+  if (_osh_mapping.base) {
+    return _osh_mmap_next(t->buffer);
+  }
+  if (!_osh_sink_enter()) {
+    return 0;
+  }
+  if (!_osh_trace_async) {
+    _osh_write_buffer(t->buffer);
+    _osh_sink_leave();
+    return 1;
+  }
+
+  struct _osh_buffer *spare =
+      t->buffer == &t->buffers[0] ? &t->buffers[1] : &t->buffers[0];
+  if (__atomic_load_n(&spare->in_flight, __ATOMIC_ACQUIRE)) {
+    _osh_sink_leave();
+    return 0;
+  }
+
+  struct _osh_writer *w = &_osh_writer;
+  struct _osh_buffer *b = t->buffer;
+  b->in_flight = 1;
+  b->next = NULL;
+  pthread_mutex_lock(&w->lock);
+  if (w->tail) {
+    w->tail->next = b;
+  } else {
+    w->head = b;
+  }
+  w->tail = b;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  _osh_sink_leave();
+
+  t->buffer = spare;
+  return 1;
+}
+
+static void *_osh_writer_main(void *arg) {
+  struct _osh_writer *w = (struct _osh_writer *)arg;
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (!w->head && !w->stop) {
+      pthread_cond_wait(&w->cond, &w->lock);
+    }
+    if (!w->head) {
+      break;
+    }
+    struct _osh_buffer *b = w->head;
+    w->head = b->next;
+    if (!w->head) {
+      w->tail = NULL;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    _osh_write_buffer(b);
+    __atomic_store_n(&b->in_flight, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+static _OSH_COLD int _osh_writer_start(void) {
+  struct _osh_writer *w = &_osh_writer;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  w->head = NULL;
+  w->tail = NULL;
+  w->stop = 0;
+  if (pthread_create(&w->thread, NULL, _osh_writer_main, w) != 0) {
+    perror("failed to start trace writer");
+    return -1;
+  }
+
+#ifdef __linux__
+  // OSH_TRACE_WRITER_CPU=n keeps the writer off the cores doing real work
+  const char *cpu = getenv("OSH_TRACE_WRITER_CPU");
+  if (cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(atoi(cpu), &set);
+    if (pthread_setaffinity_np(w->thread, sizeof(set), &set) != 0) {
+      fprintf(stderr, "failed to pin trace writer to cpu %s\n", cpu);
+    }
+  }
+#endif
+  return 0;
+}
+
+// with flush set, first hands over every thread's last, partially filled
+// buffer. at exit those stay with their threads, see _osh_exit_flush
+static _OSH_COLD void _osh_writer_stop(int flush) {
+  struct _osh_writer *w = &_osh_writer;
+
+  // waiting for the writer if needed. blocking is fine here, this only runs
+  // at finalize
+  for (struct _osh_thread *t = _osh_threads; flush && t; t = t->next) {
+    while (!_osh_flush(t)) {
+      sched_yield();
+    }
+  }
+
+  pthread_mutex_lock(&w->lock);
+  w->stop = 1;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->cond);
+}
+
+// writes a pad block so the next write starts _OSH_DIRECT_ALIGN aligned
+static _OSH_COLD void _osh_align_file(void) {
+  uint64_t off = _osh_trace_offset;
+  size_t len = _OSH_DIRECT_ALIGN -
+               (size_t)(off + sizeof(struct _osh_block)) % _OSH_DIRECT_ALIGN;
+  if (len == _OSH_DIRECT_ALIGN) {
+    len = 0;
+  }
+  struct _osh_block *pad =
+      (struct _osh_block *)calloc(1, sizeof(struct _osh_block) + len);
+  if (pad) {
+    _osh_write_block(pad, _OSH_BLOCK_PAD, 0, len);
+    free(pad);
+  }
+}
+
+#ifdef __linux__
+// an _osh_module record per object, appended to a growing buffer
+struct _osh_module_list {
+  char *data;
+  size_t len;
+  size_t cap;
+  uint64_t adds; // dlpi_adds when the list was taken
+};
+
+static int _osh_module_callback(struct dl_phdr_info *info, size_t size,
+                                void *data) {
+  struct _osh_module_list *l = (struct _osh_module_list *)data;
+  if (size >= offsetof(struct dl_phdr_info, dlpi_subs)) {
+    l->adds = info->dlpi_adds;
+  }
+  struct _osh_module m;
+  memset(&m, 0, sizeof(m));
+  m.bias = info->dlpi_addr;
+  m.start = UINT64_MAX;
+
+  const void *build_id = NULL;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+    uint64_t addr = info->dlpi_addr + ph->p_vaddr;
+    if (ph->p_type == PT_LOAD) {
+      m.start = addr < m.start ? addr : m.start;
+      m.end = addr + ph->p_memsz > m.end ? addr + ph->p_memsz : m.end;
+    } else if (ph->p_type == PT_NOTE && !build_id) {
+      // the build id note is mapped, no need to open the file
+      const char *p = (const char *)(uintptr_t)addr;
+      const char *end = p + ph->p_memsz;
+      while (p + sizeof(ElfW(Nhdr)) <= end) {
+        const ElfW(Nhdr) *n = (const ElfW(Nhdr) *)p;
+        const char *name = p + sizeof(*n);
+        const char *desc = name + ((n->n_namesz + 3) & ~3u);
+        if (n->n_type == NT_GNU_BUILD_ID && n->n_namesz == 4 &&
+            memcmp(name, "GNU", 4) == 0) {
+          build_id = desc;
+          m.build_id_len = n->n_descsz;
+          break;
+        }
+        p = desc + ((n->n_descsz + 3) & ~3u);
+      }
+    }
+  }
+
+  // the program itself has no name here
+  char exe[4096];
+  const char *path = info->dlpi_name;
+  if (!path || !*path) {
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    exe[n > 0 ? n : 0] = '\0';
+    path = exe;
+  }
+  m.path_len = (uint32_t)strlen(path) + 1;
+
+  size_t len = (sizeof(m) + m.path_len + m.build_id_len + 7) & ~(size_t)7;
+  if (l->len + len > l->cap) {
+    size_t cap = (l->len + len) * 2;
+    char *grown = (char *)realloc(l->data, cap);
+    if (!grown) {
+      return 1;
+    }
+    l->data = grown;
+    l->cap = cap;
+  }
+  char *rec = l->data + l->len;
+  memset(rec, 0, len);
+  memcpy(rec, &m, sizeof(m));
+  memcpy(rec + sizeof(m), path, m.path_len);
+  if (build_id) {
+    memcpy(rec + sizeof(m) + m.path_len, build_id, m.build_id_len);
+  }
+  l->len += len;
+  return 0;
+}
+
+static int _osh_modules_adds_callback(struct dl_phdr_info *info, size_t size,
+                                      void *data) {
+  if (size >= offsetof(struct dl_phdr_info, dlpi_subs)) {
+    *(uint64_t *)data = info->dlpi_adds;
+  }
+  return 1;
+}
+#endif
+
+// every object loaded right now, so offline tools can symbolize frames in
+// shared libraries as well as in the program. written at init and again
+// whenever something was dlopen'ed since, readers take the union
+static _OSH_COLD void _osh_write_modules(void) {
+#ifdef __linux__
+  struct _osh_module_list l = {NULL, sizeof(struct _osh_block), 0, 0};
+  l.data = (char *)malloc(4096);
+  if (!l.data) {
+    return;
+  }
+  l.cap = 4096;
+  dl_iterate_phdr(_osh_module_callback, &l);
+  __atomic_store_n(&_osh_modules_adds, l.adds, __ATOMIC_RELAXED);
+
+  uint64_t size = l.len - sizeof(struct _osh_block);
+  if (_osh_mapping.base) {
+    // a segment of its own, if it fits
+    struct _osh_block *blk = NULL;
+    if (size + sizeof(*blk) <= _osh_mapping.segment) {
+      blk = _osh_mmap_segment(_OSH_BLOCK_MODULES, 0);
+    }
+    if (blk) {
+      memcpy(blk + 1, l.data + sizeof(*blk), size);
+      __atomic_store_n(&blk->size, size, __ATOMIC_RELEASE);
+    }
+  } else if (!_osh_sink_enter()) {
+    // too late, the trace was finished at exit
+  } else if (_osh_writer.direct) {
+    // O_DIRECT wants aligned memory, with room for the pad block
+    void *aligned;
+    if (posix_memalign(&aligned, _OSH_DIRECT_ALIGN,
+                       l.len + sizeof(struct _osh_block) +
+                           _OSH_DIRECT_ALIGN) == 0) {
+      memcpy(aligned, l.data, l.len);
+      _osh_write_block((struct _osh_block *)aligned, _OSH_BLOCK_MODULES, 0,
+                       size);
+      free(aligned);
+    }
+    _osh_sink_leave();
+  } else {
+    _osh_write_block((struct _osh_block *)l.data, _OSH_BLOCK_MODULES, 0,
+                     size);
+    _osh_sink_leave();
+  }
+  free(l.data);
+#endif
+}
+
+// a new stack may have a frame in an object dlopen'ed since the last modules
+// block. glibc counts the objects ever loaded, so this is one call and a
+// compare. the thread that sees the change first writes the new list
+static _OSH_COLD void _osh_check_modules(void) {
+#ifdef __linux__
+  uint64_t adds = 0;
+  dl_iterate_phdr(_osh_modules_adds_callback, &adds);
+  uint64_t seen = __atomic_load_n(&_osh_modules_adds, __ATOMIC_RELAXED);
+  if (adds != seen &&
+      __atomic_compare_exchange_n(&_osh_modules_adds, &seen, adds, 0,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    _osh_write_modules();
+  }
+#endif
+}
+
+_OSH_INLINE uint64_t _osh_hash_frames(void *const *frames, int depth) {
+  uint64_t h = 0xcbf29ce484222325ull ^ (uint64_t)depth;
+  for (int i = 0; i < depth; i++) {
+    h ^= (uint64_t)(uintptr_t)frames[i];
+    h *= 0x100000001b3ull;
+    h ^= h >> 32;
+  }
+  return h | 1;
+}
+
+_OSH_INLINE int _osh_stack_equal(const struct _osh_stack_table *t,
+                                 uint32_t id, void *const *frames, int depth) {
+  const uint64_t *entry = &t->words[t->offsets[id]];
+  if (entry[0] != (uint64_t)depth) {
+    return 0;
+  }
+  for (int i = 0; i < depth; i++) {
+    if (entry[1 + i] != (uint64_t)(uintptr_t)frames[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// the slot holding these frames, or the empty slot where they go
+_OSH_INLINE struct _osh_stack_slot *
+_osh_stack_find(const struct _osh_stack_table *t, uint64_t hash,
+                void *const *frames, int depth) {
+  for (uint32_t i = (uint32_t)hash & t->mask;; i = (i + 1) & t->mask) {
+    struct _osh_stack_slot *slot = &t->slots[i];
+    if (slot->hash == 0 ||
+        (slot->hash == hash && _osh_stack_equal(t, slot->id, frames, depth))) {
+      return slot;
+    }
+  }
+}
+
+static _OSH_COLD int _osh_stack_table_init(struct _osh_stack_table *t) {
+  memset(t, 0, sizeof(*t));
+  t->slots = (struct _osh_stack_slot *)calloc(_OSH_STACK_TABLE_SLOTS,
+                                              sizeof(*t->slots));
+  if (!t->slots) {
+    return -1;
+  }
+  t->mask = _OSH_STACK_TABLE_SLOTS - 1;
+  return 0;
+}
+
+static _OSH_COLD void _osh_stack_table_free(struct _osh_stack_table *t) {
+  free(t->slots);
+  free(t->offsets);
+  free(t->words);
+  memset(t, 0, sizeof(*t));
+}
+
+// doubles the slot array. -1 if there is no memory for it
+static _OSH_COLD int _osh_stack_table_grow(struct _osh_stack_table *t) {
+  uint32_t n = (t->mask + 1) * 2;
+  struct _osh_stack_slot *slots =
+      n ? (struct _osh_stack_slot *)calloc(n, sizeof(*slots)) : NULL;
+  if (!slots) {
+    return -1;
+  }
+  for (uint32_t i = 0; i <= t->mask; i++) {
+    if (t->slots[i].hash == 0) {
+      continue;
+    }
+    uint32_t j = (uint32_t)t->slots[i].hash & (n - 1);
+    while (slots[j].hash != 0) {
+      j = (j + 1) & (n - 1);
+    }
+    slots[j] = t->slots[i];
+  }
+  free(t->slots);
+  t->slots = slots;
+  t->mask = n - 1;
+  return 0;
+}
+
+// gives the frames found missing at slot the next id. the table is kept at
+// most 3/4 full, so every lookup ends at an empty slot. once it can't grow,
+// new stacks get _OSH_NO_STACK
+static _OSH_COLD uint32_t _osh_stack_intern(struct _osh_stack_table *t,
+                                            struct _osh_stack_slot *slot,
+                                            uint64_t hash, void *const *frames,
+                                            int depth) {
+  if ((t->count + 1) * 4 > (t->mask + 1) * 3) {
+    if (_osh_stack_table_grow(t) != 0) {
+      return _OSH_NO_STACK;
+    }
+    uint32_t i = (uint32_t)hash & t->mask;
+    while (t->slots[i].hash != 0) {
+      i = (i + 1) & t->mask;
+    }
+    slot = &t->slots[i];
+  }
+  uint32_t id = t->count;
+
+  if (t->n_words + 1 + depth > t->cap_words) {
+    size_t cap = t->cap_words ? t->cap_words * 2 : 4096;
+    uint64_t *words = (uint64_t *)realloc(t->words, cap * sizeof(uint64_t));
+    if (!words) {
+      return _OSH_NO_STACK;
+    }
+    t->words = words;
+    t->cap_words = cap;
+  }
+  if ((id & (id - 1)) == 0) {
+    // offsets grows whenever id hits a power of two
+    uint32_t *offsets = (uint32_t *)realloc(
+        t->offsets, (id ? id * 2 : 1) * sizeof(uint32_t));
+    if (!offsets) {
+      return _OSH_NO_STACK;
+    }
+    t->offsets = offsets;
+  }
+
+  t->offsets[id] = (uint32_t)t->n_words;
+  uint64_t *entry = &t->words[t->n_words];
+  entry[0] = (uint64_t)depth;
+  for (int i = 0; i < depth; i++) {
+    entry[1 + i] = (uint64_t)(uintptr_t)frames[i];
+  }
+  t->n_words += 1 + depth;
+
+  slot->hash = hash;
+  slot->id = id;
+  t->count++;
+  return id;
+}
+
+// first sighting of a stack: intern it and stage it for the trace
+static _OSH_COLD uint32_t _osh_stack_insert(struct _osh_stack_table *t,
+                                            struct _osh_buffer *b,
+                                            struct _osh_stack_slot *slot,
+                                            uint64_t hash, void *const *frames,
+                                            int depth) {
+  uint32_t id = _osh_stack_intern(t, slot, hash, frames, depth);
+  if (id == _OSH_NO_STACK) {
+    return id;
+  }
+  const uint64_t *entry = &t->words[t->offsets[id]];
+
+  _osh_check_modules();
+  uint64_t *staged = &b->stacks[b->n_stack_words];
+  staged[0] = (uint64_t)depth << 32 | id;
+  memcpy(staged + 1, entry + 1, depth * sizeof(uint64_t));
+  b->n_stack_words += 1 + depth;
+  // in a mapped trace this is what makes the stack part of the file
+  __atomic_store_n(&b->stacks_blk->size,
+                   (uint64_t)b->n_stack_words * sizeof(uint64_t),
+                   __ATOMIC_RELEASE);
+  return id;
+}
+
+// everything calling this is inlined into the application, so our return
+// address is the call site of the wrapped shmem_* function
+static __attribute__((noinline)) void *_osh_call_site(void) {
+  return __builtin_return_address(0);
+}
+
+// walks the saved frame pointer chain, starting with the call site. stops at
+// the first link that does not point further up the thread's stack. on a
+// stack we don't know, such as before the thread is registered, a link may
+// go at most 1 MiB up instead
+static __attribute__((noinline)) int _osh_fp_walk(void **frames, int max) {
+  void **fp = (void **)__builtin_frame_address(0);
+  struct _osh_thread *t = _osh_self;
+  uintptr_t hi = 0;
+  if (t && (uintptr_t)fp >= t->stack_lo && (uintptr_t)fp < t->stack_hi) {
+    hi = t->stack_hi;
+  }
+  int depth = 0;
+  while (depth < max) {
+    void **next = (void **)fp[0];
+    void *ret = fp[1];
+    if (!ret) {
+      break;
+    }
+    frames[depth++] = ret;
+    if (next <= fp || (uintptr_t)next % sizeof(void *) != 0) {
+      break;
+    }
+    // the next frame's two words have to be on the stack as well
+    if (hi ? (uintptr_t)(next + 2) > hi
+           : (uintptr_t)next - (uintptr_t)fp > (1u << 20)) {
+      break;
+    }
+    fp = next;
+  }
+  return depth;
+}
+
+// the caller's stack the way OSH_TRACE_STACK asks for, returns its depth
+_OSH_INLINE int _osh_capture_frames(void **frames) {
+  switch (_osh_stack_mode) {
+  case _OSH_STACK_CALLER:
+    frames[0] = _osh_call_site();
+    return 1;
+  case _OSH_STACK_FP:
+    return _osh_fp_walk(frames, _osh_stack_depth);
+  case _OSH_STACK_OFF:
+    return 0;
+  default:
+    return backtrace(frames, _osh_stack_depth);
+  }
+}
+
+_OSH_INLINE uint32_t _osh_capture_stack(struct _osh_stack_table *t,
+                                        struct _osh_buffer *b) {
+  if (_osh_stack_mode == _OSH_STACK_OFF) {
+    return _OSH_NO_STACK;
+  }
+  void *frames[_OSH_MAX_FRAMES];
+  int depth = _osh_capture_frames(frames);
+  uint64_t hash = _osh_hash_frames(frames, depth);
+  struct _osh_stack_slot *slot = _osh_stack_find(t, hash, frames, depth);
+  if (slot->hash != 0) {
+    return slot->id;
+  }
+  return _osh_stack_insert(t, b, slot, hash, frames, depth);
+}
+
+_OSH_INLINE unsigned _osh_hist_bucket(uint64_t ticks) {
+  if (ticks < 4) {
+    return (unsigned)ticks;
+  }
+  unsigned msb = 63 - __builtin_clzll(ticks);
+  return (msb - 1) * 4 + (unsigned)((ticks >> (msb - 2)) & 3);
+}
+
+// smallest tick count that lands in bucket b
+static inline uint64_t _osh_hist_lower(unsigned b) {
+  if (b < 4) {
+    return b;
+  }
+  return (uint64_t)(4 + b % 4) << (b / 4 - 1);
+}
+
+static _OSH_COLD int _osh_stats_init(struct _osh_stats_table *t) {
+  memset(t, 0, sizeof(*t));
+  t->slots = (struct _osh_stat *)calloc(_OSH_STATS_SLOTS, sizeof(*t->slots));
+  if (!t->slots) {
+    perror("failed to allocate stats table");
+    return -1;
+  }
+  t->mask = _OSH_STATS_SLOTS - 1;
+  return 0;
+}
+
+_OSH_INLINE uint32_t _osh_stats_slot(uint64_t key, uint32_t mask) {
+  return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+}
+
+// doubles the slot array, keeping it at most 3/4 full
+static _OSH_COLD int _osh_stats_grow(struct _osh_stats_table *t) {
+  uint32_t n = (t->mask + 1) * 2;
+  struct _osh_stat *slots = (struct _osh_stat *)calloc(n, sizeof(*slots));
+  if (!slots) {
+    return -1;
+  }
+  for (uint32_t i = 0; i <= t->mask; i++) {
+    if (t->slots[i].key == 0) {
+      continue;
+    }
+    uint32_t j = _osh_stats_slot(t->slots[i].key, n - 1);
+    while (slots[j].key != 0) {
+      j = (j + 1) & (n - 1);
+    }
+    slots[j] = t->slots[i];
+  }
+  free(t->slots);
+  t->slots = slots;
+  t->mask = n - 1;
+  memset(t->hint, 0, sizeof(t->hint));
+  return 0;
+}
+
+// the function's hint slot belongs to another target, probe for ours
+static __attribute__((noinline)) struct _osh_stat *
+_osh_stats_lookup(struct _osh_stats_table *t, uint32_t func_id, uint64_t key) {
+  if (t->count * 4 >= (t->mask + 1) * 3 && _osh_stats_grow(t) != 0) {
+    return NULL;
+  }
+  uint32_t i = _osh_stats_slot(key, t->mask);
+  while (t->slots[i].key != key) {
+    if (t->slots[i].key == 0) {
+      t->slots[i].key = key;
+      t->slots[i].min = UINT64_MAX;
+      t->count++;
+      break;
+    }
+    i = (i + 1) & t->mask;
+  }
+  t->hint[func_id] = i;
+  return &t->slots[i];
+}
+
+_OSH_INLINE void _osh_stats_add(struct _osh_stats_table *t, uint32_t func_id,
+                                uint64_t duration, int target_pe,
+                                size_t bytes_rx, size_t bytes_tx) {
+  uint64_t key = (uint64_t)(func_id + 1) << 32 | (uint32_t)target_pe;
+  struct _osh_stat *st = &t->slots[t->hint[func_id]];
+  if (UNLIKELY(st->key != key)) {
+    st = _osh_stats_lookup(t, func_id, key);
+    if (!st) {
+      return;
+    }
+  }
+  st->calls++;
+  st->total += duration;
+  if (duration < st->min) {
+    st->min = duration;
+  }
+  if (duration > st->max) {
+    st->max = duration;
+  }
+  st->bytes_rx += bytes_rx;
+  st->bytes_tx += bytes_tx;
+  st->hist[_osh_hist_bucket(duration)]++;
+}
+
+static int _osh_stats_cmp(const void *a, const void *b) {
+  uint64_t ka = (*(const struct _osh_stat *const *)a)->key;
+  uint64_t kb = (*(const struct _osh_stat *const *)b)->key;
+  return ka < kb ? -1 : ka > kb;
+}
+
+// adds every entry of src into dst
+static _OSH_COLD void _osh_stats_merge(struct _osh_stats_table *dst,
+                                       const struct _osh_stats_table *src) {
+  for (uint32_t i = 0; src->slots && i <= src->mask; i++) {
+    const struct _osh_stat *s = &src->slots[i];
+    if (s->key == 0) {
+      continue;
+    }
+    struct _osh_stat *d =
+        _osh_stats_lookup(dst, (uint32_t)(s->key >> 32) - 1, s->key);
+    if (!d) {
+      continue;
+    }
+    d->calls += s->calls;
+    d->total += s->total;
+    d->min = s->min < d->min ? s->min : d->min;
+    d->max = s->max > d->max ? s->max : d->max;
+    d->bytes_rx += s->bytes_rx;
+    d->bytes_tx += s->bytes_tx;
+    for (unsigned b = 0; b < _OSH_HIST_BUCKETS; b++) {
+      d->hist[b] += s->hist[b];
+    }
+  }
+}
+
+// one table for the whole PE, combining every thread's
+static _OSH_COLD int _osh_stats_collect(struct _osh_stats_table *out) {
+  if (_osh_stats_init(out) != 0) {
+    return -1;
+  }
+  for (struct _osh_thread *t = _osh_threads; t; t = t->next) {
+    _osh_stats_merge(out, &t->stats);
+  }
+  return 0;
+}
+
+static _OSH_COLD void _osh_stats_dump(const struct _osh_stats_table *t) {
+  char filename[32];
+  snprintf(filename, sizeof(filename), "pstats.%03d.csv", _osh_pe_id);
+  FILE *f = fopen(filename, "w");
+  struct _osh_stat **sorted =
+      (struct _osh_stat **)malloc((t->count + 1) * sizeof(*sorted));
+  if (!f || !sorted) {
+    perror("failed to write stats");
+    if (f) {
+      fclose(f);
+    }
+    free(sorted);
+    return;
+  }
+
+  uint32_t n = 0;
+  for (uint32_t i = 0; i <= t->mask; i++) {
+    if (t->slots[i].key != 0) {
+      sorted[n++] = &t->slots[i];
+    }
+  }
+  qsort(sorted, n, sizeof(*sorted), _osh_stats_cmp);
+
+  // Histogram is lower_bound_sec:count for every non-empty bucket
+  fprintf(f, "Function,Target_PE,Calls,Total_Sec,Min_Sec,Max_Sec,Bytes_RX,"
+             "Bytes_TX,Histogram\n");
+  for (uint32_t i = 0; i < n; i++) {
+    struct _osh_stat *st = sorted[i];
+    fprintf(f, "%s,%d,%llu,%.9f,%.9f,%.9f,%llu,%llu,",
+            _osh_fn_names[(st->key >> 32) - 1], (int32_t)(uint32_t)st->key,
+            (unsigned long long)st->calls,
+            _osh_ticks_to_sec((int64_t)st->total),
+            _osh_ticks_to_sec((int64_t)st->min),
+            _osh_ticks_to_sec((int64_t)st->max),
+            (unsigned long long)st->bytes_rx,
+            (unsigned long long)st->bytes_tx);
+    for (unsigned b = 0; b < _OSH_HIST_BUCKETS; b++) {
+      if (st->hist[b]) {
+        fprintf(f, "%.3g:%llu|",
+                _osh_ticks_to_sec((int64_t)_osh_hist_lower(b)),
+                (unsigned long long)st->hist[b]);
+      }
+    }
+    fputc('\n', f);
+  }
+  free(sorted);
+  fclose(f);
+}
+
+static _OSH_COLD void _osh_stats_free(struct _osh_stats_table *t) {
+  free(t->slots);
+  memset(t, 0, sizeof(*t));
+}
+
+static _OSH_COLD void _osh_summary_write(const uint32_t *fns, uint32_t n,
+                                         const uint64_t *sum,
+                                         const uint64_t *min,
+                                         const uint64_t *max) {
+  FILE *f = fopen("psummary.csv", "w");
+  if (!f) {
+    perror("failed to write job summary");
+    return;
+  }
+
+  // PE_Min_Sec / PE_Max_Sec are the least and most time a single PE spent
+  // in the function, a quick look at load imbalance
+  fprintf(f, "Function,PEs,Calls,Total_Sec,Min_Sec,Max_Sec,PE_Min_Sec,"
+             "PE_Max_Sec,Bytes_RX,Bytes_TX,Histogram\n");
+  for (uint32_t r = 0; r < n; r++) {
+    const uint64_t *row = sum + (size_t)r * _OSH_SUM_FIELDS;
+    fprintf(f, "%s,%llu,%llu,%.9f,%.9f,%.9f,%.9f,%.9f,%llu,%llu,",
+            _osh_fn_names[fns[r]], (unsigned long long)row[_OSH_SUM_PES],
+            (unsigned long long)row[_OSH_SUM_CALLS],
+            row[_OSH_SUM_TOTAL] * 1e-9, min[r * 2] * 1e-9, max[r * 2] * 1e-9,
+            min[r * 2 + 1] * 1e-9, max[r * 2 + 1] * 1e-9,
+            (unsigned long long)row[_OSH_SUM_RX],
+            (unsigned long long)row[_OSH_SUM_TX]);
+    for (unsigned b = 0; b < _OSH_HIST_BUCKETS; b++) {
+      if (row[_OSH_SUM_HIST + b]) {
+        fprintf(f, "%.3g:%llu|", _osh_hist_lower(b) * 1e-9,
+                (unsigned long long)row[_OSH_SUM_HIST + b]);
+      }
+    }
+    fputc('\n', f);
+  }
+  fclose(f);
+}
+
+// reduces every PE's stats table onto PE 0, which writes psummary.csv.
+// collective, must run on all PEs before pshmem_finalize. values are
+// converted to ns first since every PE calibrated its own tick rate
+static _OSH_COLD void _osh_stats_reduce(const struct _osh_stats_table *t) {
+  enum { words = (_OSH_FN_COUNT + 63) / 64 };
+
+  // agree on which functions anyone called, so only those rows go over
+  // the network
+  uint64_t *used = (uint64_t *)pshmem_malloc(2 * words * sizeof(uint64_t));
+  if (!used) {
+    return;
+  }
+  memset(used, 0, words * sizeof(uint64_t));
+  for (uint32_t i = 0; t->slots && i <= t->mask; i++) {
+    if (t->slots[i].key != 0) {
+      uint32_t fn = (uint32_t)(t->slots[i].key >> 32) - 1;
+      used[fn / 64] |= 1ull << (fn % 64);
+    }
+  }
+  pshmem_uint64_or_reduce(SHMEM_TEAM_WORLD, used + words, used, words);
+
+  uint32_t *row_of = (uint32_t *)malloc(_OSH_FN_COUNT * sizeof(uint32_t));
+  uint32_t *fns = (uint32_t *)malloc(_OSH_FN_COUNT * sizeof(uint32_t));
+  uint32_t n = 0;
+  for (uint32_t fn = 0; fn < _OSH_FN_COUNT; fn++) {
+    if (used[words + fn / 64] & (1ull << (fn % 64))) {
+      if (row_of && fns) {
+        row_of[fn] = n;
+        fns[n] = fn;
+      }
+      n++;
+    }
+  }
+
+  // sum, min and max sources followed by their destinations. every PE
+  // computed the same n, so the symmetric allocation matches
+  size_t n_sum = (size_t)n * _OSH_SUM_FIELDS, n_mm = (size_t)n * 2;
+  uint64_t *buf = n ? (uint64_t *)pshmem_malloc(2 * (n_sum + 2 * n_mm) *
+                                                sizeof(uint64_t))
+                    : NULL;
+  if (buf) {
+    uint64_t *sum = buf, *min = sum + 2 * n_sum, *max = min + 2 * n_mm;
+    memset(sum, 0, n_sum * sizeof(uint64_t));
+    memset(min, 0xff, n_mm * sizeof(uint64_t));
+    memset(max, 0, n_mm * sizeof(uint64_t));
+
+    for (uint32_t i = 0; row_of && fns && t->slots && i <= t->mask; i++) {
+      const struct _osh_stat *st = &t->slots[i];
+      if (st->key == 0) {
+        continue;
+      }
+      uint32_t r = row_of[(st->key >> 32) - 1];
+      uint64_t *row = sum + (size_t)r * _OSH_SUM_FIELDS;
+      uint64_t st_min = (uint64_t)(st->min * _osh_ns_per_tick);
+      uint64_t st_max = (uint64_t)(st->max * _osh_ns_per_tick);
+      row[_OSH_SUM_CALLS] += st->calls;
+      row[_OSH_SUM_TOTAL] += (uint64_t)(st->total * _osh_ns_per_tick);
+      row[_OSH_SUM_RX] += st->bytes_rx;
+      row[_OSH_SUM_TX] += st->bytes_tx;
+      row[_OSH_SUM_PES] = 1;
+      for (unsigned b = 0; b < _OSH_HIST_BUCKETS; b++) {
+        if (st->hist[b]) {
+          uint64_t ns = (uint64_t)(_osh_hist_lower(b) * _osh_ns_per_tick);
+          row[_OSH_SUM_HIST + _osh_hist_bucket(ns)] += st->hist[b];
+        }
+      }
+      if (st_min < min[r * 2]) {
+        min[r * 2] = st_min;
+      }
+      if (st_max > max[r * 2]) {
+        max[r * 2] = st_max;
+      }
+    }
+    for (uint32_t r = 0; r < n; r++) {
+      if (sum[(size_t)r * _OSH_SUM_FIELDS + _OSH_SUM_PES]) {
+        min[r * 2 + 1] = max[r * 2 + 1] =
+            sum[(size_t)r * _OSH_SUM_FIELDS + _OSH_SUM_TOTAL];
+      }
+    }
+
+    pshmem_uint64_sum_reduce(SHMEM_TEAM_WORLD, sum + n_sum, sum, n_sum);
+    pshmem_uint64_min_reduce(SHMEM_TEAM_WORLD, min + n_mm, min, n_mm);
+    pshmem_uint64_max_reduce(SHMEM_TEAM_WORLD, max + n_mm, max, n_mm);
+    if (_osh_pe_id == 0 && row_of && fns) {
+      _osh_summary_write(fns, n, sum + n_sum, min + n_mm, max + n_mm);
+    }
+    pshmem_free(buf);
+  }
+  free(row_of);
+  free(fns);
+  pshmem_free(used);
+}
+
+static _OSH_COLD uint64_t *_osh_comm_alloc(void) {
+  uint64_t *comm = (uint64_t *)calloc(
+      (size_t)_osh_comm_pes * _OSH_COMM_FIELDS, sizeof(uint64_t));
+  if (!comm) {
+    perror("failed to allocate communication matrix");
+  }
+  return comm;
+}
+
+_OSH_INLINE void _osh_comm_add(uint64_t *comm, int target_pe, size_t bytes_rx,
+                               size_t bytes_tx) {
+  if (UNLIKELY((uint32_t)target_pe >= _osh_comm_pes)) {
+    return;
+  }
+  uint64_t *row = comm + (size_t)target_pe * _OSH_COMM_FIELDS;
+  size_t size = bytes_rx > bytes_tx ? bytes_rx : bytes_tx;
+  unsigned bucket =
+      size <= 8 ? 0 : (unsigned)(64 - __builtin_clzll(size - 1) - 1) / 3;
+  if (bucket >= _OSH_COMM_SIZE_BUCKETS) {
+    bucket = _OSH_COMM_SIZE_BUCKETS - 1;
+  }
+  row[_OSH_COMM_TX] += bytes_tx;
+  row[_OSH_COMM_RX] += bytes_rx;
+  row[_OSH_COMM_MSGS]++;
+  row[_OSH_COMM_SIZES + bucket]++;
+}
+
+// NPY 1.0 header for a little endian uint64 array, so numpy.load can read
+// the matrix directly
+static _OSH_COLD void _osh_npy_header(FILE *f, const char *shape) {
+  char dict[128];
+  int len = snprintf(dict, sizeof(dict),
+                     "{'descr': '<u8', 'fortran_order': False, "
+                     "'shape': (%s), }",
+                     shape);
+  // magic, version and length take 10 bytes, the whole header is padded
+  // with spaces to a multiple of 64 and ends in a newline
+  int total = (10 + len + 1 + 63) / 64 * 64;
+  uint16_t hlen = (uint16_t)(total - 10);
+  fwrite("\x93NUMPY\x01\x00", 1, 8, f);
+  fputc(hlen & 0xff, f);
+  fputc(hlen >> 8, f);
+  fprintf(f, "%s%*s\n", dict, total - 10 - len - 1, "");
+}
+
+// this PE's row, summed over its threads. NULL if it can't be allocated
+static _OSH_COLD uint64_t *_osh_comm_collect(void) {
+  uint64_t *comm = _osh_comm_alloc();
+  if (!comm) {
+    return NULL;
+  }
+  size_t n = (size_t)_osh_comm_pes * _OSH_COMM_FIELDS;
+  // at exit threads may still be registering
+  struct _osh_thread *head = __atomic_load_n(&_osh_threads, __ATOMIC_ACQUIRE);
+  for (struct _osh_thread *t = head; t; t = t->next) {
+    for (size_t i = 0; t->comm && i < n; i++) {
+      comm[i] += t->comm[i];
+    }
+  }
+  return comm;
+}
+
+// this PE's row of the matrix as pcomm.NNN.npy, shape (n_pes, fields)
+static _OSH_COLD void _osh_comm_dump(const uint64_t *comm) {
+  char filename[32], shape[64];
+  snprintf(filename, sizeof(filename), "pcomm.%03d.npy", _osh_pe_id);
+  FILE *f = fopen(filename, "wb");
+  if (!f) {
+    perror("failed to write communication matrix");
+    return;
+  }
+  snprintf(shape, sizeof(shape), "%u, %d", _osh_comm_pes, _OSH_COMM_FIELDS);
+  _osh_npy_header(f, shape);
+  fwrite(comm, sizeof(uint64_t), (size_t)_osh_comm_pes * _OSH_COMM_FIELDS, f);
+  fclose(f);
+}
+
+// PE 0 pulls every PE's row and streams them into pcomm.npy, shape
+// (n_pes, n_pes, fields), so it never holds more than one row. collective
+static _OSH_COLD void _osh_comm_gather(const uint64_t *comm) {
+  uint32_t n_pes = (uint32_t)pshmem_n_pes();
+  size_t row_len = (size_t)n_pes * _OSH_COMM_FIELDS * sizeof(uint64_t);
+  uint64_t *sym = (uint64_t *)pshmem_malloc(row_len);
+  if (!sym) {
+    return;
+  }
+  if (comm && _osh_comm_pes == n_pes) {
+    memcpy(sym, comm, row_len);
+  } else {
+    memset(sym, 0, row_len);
+  }
+  pshmem_barrier_all();
+
+  if (_osh_pe_id == 0) {
+    FILE *f = fopen("pcomm.npy", "wb");
+    uint64_t *row = (uint64_t *)malloc(row_len);
+    if (f && row) {
+      char shape[64];
+      snprintf(shape, sizeof(shape), "%u, %u, %d", n_pes, n_pes,
+               _OSH_COMM_FIELDS);
+      _osh_npy_header(f, shape);
+      for (uint32_t pe = 0; pe < n_pes; pe++) {
+        pshmem_getmem(row, sym, row_len, (int)pe);
+        fwrite(row, 1, row_len, f);
+      }
+    } else {
+      perror("failed to write communication matrix");
+    }
+    if (f) {
+      fclose(f);
+    }
+    free(row);
+  }
+  pshmem_barrier_all();
+  pshmem_free(sym);
+}
+
+// reserves the next record in the binary buffer, with room for a new stack,
+// or returns NULL if it had to be dropped
+_OSH_INLINE struct _osh_event *_osh_next_event(struct _osh_thread *t) {
+  struct _osh_buffer *b = t->buffer;
+  if (UNLIKELY(b->n_events == b->cap_events ||
+               b->n_stack_words + 1 + _OSH_MAX_FRAMES > b->cap_stack_words)) {
+    if (!_osh_flush(t)) {
+      __atomic_fetch_add(&_osh_events_dropped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    b = t->buffer;
+  }
+  return &b->events[b->n_events++];
+}
+
+// the record from _osh_next_event is filled in. a mapped trace's block size
+// is only ever raised past complete records, the other sinks overwrite it
+// when the block is written
+_OSH_INLINE void _osh_commit_event(struct _osh_buffer *b) {
+  __atomic_store_n(&b->events_blk->size,
+                   (uint64_t)b->n_events * sizeof(struct _osh_event),
+                   __ATOMIC_RELEASE);
+}
+
+// the calls that wait for outstanding nbi operations to complete. pending
+// operations are kept per thread, not per context, so a ctx_quiet retires all
+// of the calling thread's
+_OSH_INLINE int _osh_fn_completes_nbi(uint32_t func_id) {
+  return func_id == _OSH_FN_shmem_quiet ||
+         func_id == _OSH_FN_shmem_ctx_quiet ||
+         func_id == _OSH_FN_shmem_barrier_all ||
+         func_id == _OSH_FN_shmem_barrier;
+}
+
+static _OSH_COLD int _osh_nbi_grow(struct _osh_nbi_list *l) {
+  uint32_t cap = l->cap ? l->cap * 2 : _OSH_NBI_INITIAL_OPS;
+  struct _osh_nbi_op *ops =
+      (struct _osh_nbi_op *)realloc(l->ops, cap * sizeof(struct _osh_nbi_op));
+  if (!ops) {
+    return -1;
+  }
+  l->ops = ops;
+  l->cap = cap;
+  return 0;
+}
+
+_OSH_INLINE void _osh_nbi_issue(struct _osh_nbi_list *l, uint32_t func_id,
+                                uint64_t start, int target_pe,
+                                size_t bytes_rx, size_t bytes_tx,
+                                uint32_t stack_id, int recorded) {
+  if (UNLIKELY(l->count == l->cap) && _osh_nbi_grow(l) != 0) {
+    return;
+  }
+  struct _osh_nbi_op *op = &l->ops[l->count++];
+  op->start = start;
+  op->bytes_rx = bytes_rx;
+  op->bytes_tx = bytes_tx;
+  op->target_pe = target_pe;
+  op->func_id = func_id;
+  op->stack_id = stack_id;
+  op->recorded = recorded;
+}
+
+// logs an nbi_complete for every pending operation, spanning issue to
+// `end`, with the issuing call's stack and its function id in aux. only
+// operations whose own event was recorded get one. returns the number
+// retired and adds up their bytes for the completing call
+static __attribute__((noinline)) uint32_t
+_osh_nbi_retire(struct _osh_thread *t, uint64_t end, size_t *bytes_rx,
+                size_t *bytes_tx) {
+  uint32_t n = t->nbi.count;
+  for (uint32_t i = 0; i < n; i++) {
+    struct _osh_nbi_op *op = &t->nbi.ops[i];
+    uint64_t duration = end - op->start;
+    *bytes_rx += op->bytes_rx;
+    *bytes_tx += op->bytes_tx;
+    if (_osh_trace_mode & (_OSH_TRACE_STATS | _OSH_TRACE_SUMMARY)) {
+      _osh_stats_add(&t->stats, _OSH_FN_nbi_complete, duration,
+                     op->target_pe, op->bytes_rx, op->bytes_tx);
+    }
+    if (!op->recorded) {
+      continue;
+    }
+    if (_osh_trace_mode & _OSH_TRACE_CSV) {
+      _osh_log_csv(t->tid, _OSH_FN_nbi_complete, duration, op->start,
+                   op->target_pe, op->bytes_rx, op->bytes_tx, NULL, 0,
+                   (char *)_osh_fn_names[op->func_id]);
+    } else if (_osh_trace_mode & _OSH_TRACE_BIN) {
+      struct _osh_event *ev = _osh_next_event(t);
+      if (ev) {
+        ev->start = op->start;
+        ev->duration = duration;
+        ev->bytes_rx = op->bytes_rx;
+        ev->bytes_tx = op->bytes_tx;
+        ev->func_id = _OSH_FN_nbi_complete;
+        ev->target_pe = op->target_pe;
+        ev->stack_id = op->stack_id;
+        ev->aux = op->func_id;
+        _osh_commit_event(t->buffer);
+      }
+    }
+  }
+  t->nbi.count = 0;
+  return n;
+}
+
+static _OSH_COLD int _osh_buffer_alloc(struct _osh_buffer *b, uint32_t cap) {
+  memset(b, 0, sizeof(*b));
+  b->cap_events = cap;
+  b->cap_stack_words = (cap < _OSH_STACK_BUFFER_ENTRIES
+                            ? cap
+                            : _OSH_STACK_BUFFER_ENTRIES) *
+                     (1 + _OSH_MAX_FRAMES);
+
+  // aligned and with room for a trailing pad block, for O_DIRECT
+  size_t slack = sizeof(struct _osh_block) * 2 + _OSH_DIRECT_ALIGN;
+  void *events = NULL;
+  void *stacks = NULL;
+  if (posix_memalign(&events, _OSH_DIRECT_ALIGN,
+                     cap * sizeof(struct _osh_event) + slack) ||
+      posix_memalign(&stacks, _OSH_DIRECT_ALIGN,
+                     b->cap_stack_words * sizeof(uint64_t) + slack)) {
+    perror("failed to allocate trace buffer");
+    free(events);
+    memset(b, 0, sizeof(*b));
+    return -1;
+  }
+  b->events_blk = (struct _osh_block *)events;
+  b->events = (struct _osh_event *)(b->events_blk + 1);
+  b->stacks_blk = (struct _osh_block *)stacks;
+  b->stacks = (uint64_t *)(b->stacks_blk + 1);
+  return 0;
+}
+
+static _OSH_COLD void _osh_buffer_free(struct _osh_buffer *b) {
+  free(b->events_blk);
+  free(b->stacks_blk);
+  memset(b, 0, sizeof(*b));
+}
+
+static _OSH_COLD void _osh_thread_free(struct _osh_thread *t) {
+  _osh_buffer_free(&t->buffers[0]);
+  _osh_buffer_free(&t->buffers[1]);
+  _osh_stack_table_free(&t->stacks);
+  _osh_stats_free(&t->stats);
+  free(t->nbi.ops);
+  free(t->comm);
+  free(t);
+}
+
+// sets up the calling thread for whatever the trace mode needs and publishes
+// it on _osh_threads. NULL if that fails, the call then goes unlogged
+static _OSH_COLD struct _osh_thread *_osh_thread_register(void) {
+  struct _osh_thread *t =
+      (struct _osh_thread *)calloc(1, sizeof(struct _osh_thread));
+  if (!t) {
+    return NULL;
+  }
+  t->tid = __atomic_fetch_add(&_osh_n_threads, 1, __ATOMIC_RELAXED);
+
+  int mode = _osh_trace_mode;
+  int failed = 0;
+  if (mode & _OSH_TRACE_BIN) {
+    failed |= _osh_stack_table_init(&t->stacks) != 0;
+    // a mapped trace's buffer starts out full, so the first event claims
+    // its segments
+    if (!_osh_mapping.base) {
+      failed |= _osh_buffer_alloc(&t->buffers[0], _osh_buffer_events) != 0;
+    }
+    if (_osh_trace_async) {
+      failed |= _osh_buffer_alloc(&t->buffers[1], _osh_buffer_events) != 0;
+    }
+    t->buffers[0].tid = t->buffers[1].tid = t->tid;
+    t->buffer = &t->buffers[0];
+  }
+  if (mode & (_OSH_TRACE_STATS | _OSH_TRACE_SUMMARY)) {
+    failed |= _osh_stats_init(&t->stats) != 0;
+  }
+  if (mode & _OSH_TRACE_COMM) {
+    failed |= (t->comm = _osh_comm_alloc()) == NULL;
+  }
+  if (failed) {
+    _osh_thread_free(t);
+    return NULL;
+  }
+#ifdef __linux__
+  // bounds the frame pointer walk
+  if (_osh_stack_mode == _OSH_STACK_FP) {
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+      void *lo;
+      size_t size;
+      if (pthread_attr_getstack(&attr, &lo, &size) == 0) {
+        t->stack_lo = (uintptr_t)lo;
+        t->stack_hi = (uintptr_t)lo + size;
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+#endif
+
+  t->next = __atomic_load_n(&_osh_threads, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&_osh_threads, &t->next, t, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+  _osh_self = t;
+  return t;
+}
+
+// the threads of a PE share its slot, so writers take the seqlock with a
+// CAS. returns the odd seq to hand to _osh_live_unlock
+_OSH_INLINE uint64_t _osh_live_lock(struct _osh_live_slot *s) {
+  uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+  while ((seq & 1) ||
+         !__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 1,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+  }
+  // a reader that sees any of the updates also sees seq odd
+  _OSH_LIVE_FENCE();
+  return seq + 1;
+}
+
+_OSH_INLINE void _osh_live_unlock(struct _osh_live_slot *s, uint64_t seq) {
+  __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// a wrapper is about to call into pshmem
+_OSH_INLINE void _osh_live_enter(uint32_t func_id, uint64_t start) {
+  struct _osh_live_slot *s = _osh_live.slot;
+  uint64_t seq = _osh_live_lock(s);
+  s->in_flight++;
+  s->func_id = func_id;
+  s->call_start = start;
+  _osh_live_unlock(s, seq);
+}
+
+_OSH_INLINE void _osh_live_exit(uint32_t func_id, uint64_t start,
+                                uint64_t duration, uint64_t bytes) {
+  struct _osh_live_slot *s = _osh_live.slot;
+  struct _osh_live_class *c = &s->classes[_osh_fn_class(func_id)];
+  uint64_t seq = _osh_live_lock(s);
+  if (s->in_flight) {
+    s->in_flight--;
+  }
+  s->last_return = start + duration;
+  c->calls++;
+  c->bytes += bytes;
+  c->ticks += duration;
+  _osh_live_unlock(s, seq);
+}
+
+// what shm_open does on Linux, without needing librt before glibc 2.34
+static _OSH_COLD int _osh_live_shm_open(const char *name, int flags) {
+#ifdef __linux__
+  char path[80];
+  snprintf(path, sizeof(path), "/dev/shm%s", name);
+  return open(path, flags | O_NOFOLLOW | O_CLOEXEC, 0600);
+#else
+  return shm_open(name, flags, 0600);
+#endif
+}
+
+static _OSH_COLD void _osh_live_shm_unlink(const char *name) {
+#ifdef __linux__
+  char path[80];
+  snprintf(path, sizeof(path), "/dev/shm%s", name);
+  unlink(path);
+#else
+  shm_unlink(name);
+#endif
+}
+
+// the leader creates the segment, sized for its node's PEs
+static _OSH_COLD char *_osh_live_map(const char *name, size_t size,
+                                     int create) {
+  int fd = _osh_live_shm_open(name, create ? O_RDWR | O_CREAT | O_EXCL
+                                           : O_RDWR);
+  if (fd == -1) {
+    return NULL;
+  }
+  void *base = MAP_FAILED;
+  if (!create || ftruncate(fd, (off_t)size) == 0) {
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  return base == MAP_FAILED ? NULL : (char *)base;
+}
+
+// OSH_TRACE_MODE=live. collective: PE 0's pid names the segment on every
+// node, and the first PE of each node creates it before the others map it.
+// every PE takes part even when its own part fails
+static _OSH_COLD int _osh_live_open(void) {
+  struct _osh_live *l = &_osh_live;
+  int32_t *word = (int32_t *)pshmem_malloc(sizeof(*word));
+  if (!word) {
+    return -1;
+  }
+  if (_osh_pe_id == 0) {
+    *word = (int32_t)getpid();
+  }
+  pshmem_barrier_all();
+  int32_t pid0;
+  pshmem_getmem(&pid0, word, sizeof(pid0), 0);
+  pshmem_barrier_all();
+  pshmem_free(word);
+
+  int rank = pshmem_team_my_pe(SHMEM_TEAM_SHARED);
+  int n_local = pshmem_team_n_pes(SHMEM_TEAM_SHARED);
+  snprintf(l->name, sizeof(l->name), "/osh-%u-%d", (unsigned)getuid(),
+           (int)pid0);
+  size_t names_size = 0;
+  for (int fn = 0; fn < _OSH_FN_COUNT; fn++) {
+    names_size += strlen(_osh_fn_names[fn]) + 1;
+  }
+  size_t names_offset = _OSH_LIVE_SLOTS_OFFSET +
+                        (size_t)(n_local > 0 ? n_local : 0) *
+                            sizeof(struct _osh_live_slot);
+  l->size = names_offset + names_size;
+
+  l->leader = rank == 0;
+  if (l->leader) {
+    // a segment left behind by a crashed job with a recycled pid
+    _osh_live_shm_unlink(l->name);
+    l->base = _osh_live_map(l->name, l->size, 1);
+    if (l->base) {
+      struct _osh_live_header *h = (struct _osh_live_header *)l->base;
+      h->version = _OSH_LIVE_VERSION;
+      h->n_slots = (uint32_t)n_local;
+      h->slot_size = sizeof(struct _osh_live_slot);
+      h->slots_offset = _OSH_LIVE_SLOTS_OFFSET;
+      h->n_classes = _OSH_CLASS_COUNT;
+      h->names_offset = (uint32_t)names_offset;
+      h->names_size = (uint32_t)names_size;
+      h->n_pes = pshmem_n_pes();
+      char *names = l->base + names_offset;
+      for (int fn = 0; fn < _OSH_FN_COUNT; fn++) {
+        size_t len = strlen(_osh_fn_names[fn]) + 1;
+        memcpy(names, _osh_fn_names[fn], len);
+        names += len;
+      }
+      _OSH_LIVE_FENCE();
+      memcpy(h->magic, _OSH_LIVE_MAGIC, sizeof(h->magic));
+    } else {
+      _osh_live_shm_unlink(l->name);
+    }
+  }
+  pshmem_barrier_all();
+  if (rank > 0) {
+    l->base = _osh_live_map(l->name, l->size, 0);
+  }
+
+  struct _osh_live_header *h = (struct _osh_live_header *)l->base;
+  if (!h || rank < 0 || memcmp(h->magic, _OSH_LIVE_MAGIC, 8) != 0 ||
+      h->n_slots != (uint32_t)n_local) {
+    if (l->base) {
+      munmap(l->base, l->size);
+      l->base = NULL;
+    }
+    fprintf(stderr, "PE %d: no live telemetry in /dev/shm%s\n", _osh_pe_id,
+            l->name);
+    return -1;
+  }
+
+  struct _osh_live_slot *s =
+      (struct _osh_live_slot *)(l->base + _OSH_LIVE_SLOTS_OFFSET) + rank;
+  uint64_t seq = _osh_live_lock(s);
+  s->pe = _osh_pe_id;
+  s->pid = (int32_t)getpid();
+  s->clock_base = _osh_clock_base;
+  s->ns_per_tick = _osh_ns_per_tick;
+  s->state = _OSH_LIVE_RUNNING;
+  _osh_live_unlock(s, seq);
+  l->slot = s;
+  return 0;
+}
+
+// the mapping stays, threads may still be inside a wrapper. the name goes,
+// a finished job leaves nothing in /dev/shm
+static _OSH_COLD void _osh_live_close(void) {
+  struct _osh_live_slot *s = _osh_live.slot;
+  uint64_t seq = _osh_live_lock(s);
+  s->state = _OSH_LIVE_DONE;
+  s->in_flight = 0;
+  _osh_live_unlock(s, seq);
+  if (_osh_live.leader) {
+    _osh_live_shm_unlink(_osh_live.name);
+  }
+}
+
+// the barriers OSH_TRACE_BARRIER_WINDOW counts, every PE calls these
+_OSH_INLINE int _osh_fn_counts_barrier(uint32_t func_id) {
+  return func_id == _OSH_FN_shmem_barrier_all ||
+         func_id == _OSH_FN_shmem_barrier || func_id == _OSH_FN_shmem_sync_all;
+}
+
+// calls every PE (of a team) makes in the same order: the collective class,
+// the barriers, sync and team_sync. each gets a sequence number per function
+// and team, so the n-th call on one PE is the same collective as the n-th on
+// another PE of that team
+_OSH_INLINE int _osh_fn_collective(uint32_t func_id) {
+  return _osh_fn_class(func_id) == _OSH_CLASS_COLLECTIVE ||
+         _osh_fn_counts_barrier(func_id) || func_id == _OSH_FN_shmem_sync ||
+         func_id == _OSH_FN_shmem_team_sync;
+}
+
+_OSH_INLINE struct _osh_team _osh_world(void) {
+  struct _osh_team world = {0, 0, 0};
+  return world;
+}
+
+// the world if that's all the PEs, one that isn't valid without any
+static inline struct _osh_team _osh_team_make(int start, int stride,
+                                              int size) {
+  struct _osh_team team = {start, size > 1 ? stride : 1, size};
+  if (start < 0 || size <= 0) {
+    team.start = -1;
+    team.stride = team.size = 0;
+  } else if (start == 0 && team.stride == 1 && size == pshmem_n_pes()) {
+    team = _osh_world();
+  }
+  return team;
+}
+
+// the PEs of an active set, PE_start and on in steps of 2^logPE_stride
+static inline struct _osh_team _osh_active_set(int PE_start, int logPE_stride,
+                                               int PE_size) {
+  return _osh_team_make(PE_start, 1 << logPE_stride, PE_size);
+}
+
+// the PEs of a team, through the world PEs of its first two members. every
+// team is strided, split_2d's too
+static inline struct _osh_team _osh_team_of(shmem_team_t team) {
+  if (team == SHMEM_TEAM_WORLD) {
+    return _osh_world();
+  }
+  int size = pshmem_team_n_pes(team);
+  if (size <= 0) {
+    return _osh_team_make(-1, 0, 0);
+  }
+  int start = pshmem_team_translate_pe(team, 0, SHMEM_TEAM_WORLD);
+  int stride =
+      size > 1 ? pshmem_team_translate_pe(team, 1, SHMEM_TEAM_WORLD) - start
+               : 1;
+  return _osh_team_make(start, stride, size);
+}
+
+_OSH_INLINE uint32_t _osh_team_seq_slot(uint32_t func_id,
+                                        struct _osh_team team,
+                                        uint32_t mask) {
+  uint64_t key = (uint64_t)func_id << 44 ^ (uint64_t)(uint32_t)team.size << 24 ^
+                 (uint64_t)(uint32_t)team.stride << 12 ^ (uint32_t)team.start;
+  return (uint32_t)(key * 0x9e3779b97f4a7c15ull >> 32) & mask;
+}
+
+// the slot of func_id on team, or the empty one where it would go
+static struct _osh_team_seq *_osh_team_seq_find(struct _osh_team_seqs *h,
+                                                uint32_t func_id,
+                                                struct _osh_team team) {
+  uint32_t i = _osh_team_seq_slot(func_id, team, h->mask);
+  for (;; i = (i + 1) & h->mask) {
+    struct _osh_team_seq *s = &h->slots[i];
+    if (s->team.size == 0 ||
+        (s->func_id == func_id && s->team.start == team.start &&
+         s->team.stride == team.stride && s->team.size == team.size)) {
+      return s;
+    }
+  }
+}
+
+// doubles the table, -1 if there is no memory for it
+static _OSH_COLD int _osh_team_seq_grow(struct _osh_team_seqs *h) {
+  uint32_t n = (h->mask + 1) * 2;
+  struct _osh_team_seq *slots =
+      (struct _osh_team_seq *)calloc(n, sizeof(*slots));
+  if (!slots) {
+    return -1;
+  }
+  for (uint32_t i = 0; i <= h->mask; i++) {
+    struct _osh_team_seq *s = &h->slots[i];
+    if (s->team.size == 0) {
+      continue;
+    }
+    uint32_t j = _osh_team_seq_slot(s->func_id, s->team, n - 1);
+    while (slots[j].team.size != 0) {
+      j = (j + 1) & (n - 1);
+    }
+    slots[j] = *s;
+  }
+  free(h->slots);
+  h->slots = slots;
+  h->mask = n - 1;
+  return 0;
+}
+
+// the next number of func_id on a team other than the world. 0, unnumbered,
+// for a team that isn't valid, or a new one with the table full
+static _OSH_COLD uint32_t _osh_team_seq_next(uint32_t func_id,
+                                             struct _osh_team team) {
+  struct _osh_team_seqs *h = &_osh_team_seqs;
+  if (team.start < 0) {
+    return 0;
+  }
+  uint32_t seq = 0;
+  pthread_mutex_lock(&h->lock);
+  if (!h->slots) {
+    h->slots = (struct _osh_team_seq *)calloc(_OSH_TEAM_SEQ_SLOTS,
+                                              sizeof(*h->slots));
+    h->mask = _OSH_TEAM_SEQ_SLOTS - 1;
+    h->count = 0;
+  }
+  struct _osh_team_seq *s =
+      h->slots ? _osh_team_seq_find(h, func_id, team) : NULL;
+  if (s && s->team.size == 0) {
+    if ((h->count + 1) * 4 > (h->mask + 1) * 3) {
+      s = _osh_team_seq_grow(h) == 0 ? _osh_team_seq_find(h, func_id, team)
+                                     : NULL;
+    }
+    if (s) {
+      s->team = team;
+      s->func_id = func_id;
+      h->count++;
+    }
+  }
+  if (s) {
+    seq = ++s->seq;
+  }
+  pthread_mutex_unlock(&h->lock);
+  return seq;
+}
+
+// the sequence number of a collective call
+_OSH_INLINE uint32_t _osh_collective_next(uint32_t func_id,
+                                          struct _osh_team team) {
+  if (team.size == 0 && team.start == 0) {
+    return __atomic_add_fetch(&_osh_collective_seq[func_id], 1,
+                              __ATOMIC_RELAXED);
+  }
+  return _osh_team_seq_next(func_id, team);
+}
+
+// whether a call entered at start falls inside the time and barrier windows
+_OSH_INLINE int _osh_window_pass(uint32_t func_id, uint64_t start) {
+  int filter = _osh_filter;
+  int pass = 1;
+  if (filter & _OSH_FILTER_TIME) {
+    pass &= start >= _osh_window[0] && start < _osh_window[1];
+  }
+  if (filter & _OSH_FILTER_BARRIERS) {
+    // a barrier belongs to the window that was open when it was entered
+    uint64_t n = _osh_fn_counts_barrier(func_id)
+                     ? __atomic_fetch_add(&_osh_barriers, 1, __ATOMIC_RELAXED)
+                     : __atomic_load_n(&_osh_barriers, __ATOMIC_RELAXED);
+    pass &= n >= _osh_barrier_window[0] && n < _osh_barrier_window[1];
+  }
+  return pass;
+}
+
+// what a call that isn't traced still counts: a collective takes its number
+// so the others stay matched, and a quiet completes whatever the thread had
+// outstanding
+_OSH_INLINE void _osh_untraced(uint32_t func_id, struct _osh_team team) {
+  if (_osh_fn_collective(func_id)) {
+    _osh_collective_next(func_id, team);
+  }
+  if (_osh_fn_completes_nbi(func_id) && _osh_self) {
+    _osh_self->nbi.count = 0;
+  }
+}
+
+// whether a wrapper traces this call, and if so when it started. an
+// excluded function is a byte load and goes straight to pshmem without
+// reading the clock, a call outside a window right after reading it. with
+// func_id constant the rest folds away
+_OSH_INLINE int _osh_trace_begin(uint32_t func_id, struct _osh_team team,
+                                 uint64_t *start) {
+  if (UNLIKELY(!_osh_fn_traced[func_id])) {
+    if (_osh_fn_counts_barrier(func_id) &&
+        (_osh_filter & _OSH_FILTER_BARRIERS)) {
+      __atomic_fetch_add(&_osh_barriers, 1, __ATOMIC_RELAXED);
+    }
+    _osh_untraced(func_id, team);
+    return 0;
+  }
+  *start = _osh_get_ticks();
+  if (UNLIKELY(_osh_filter & (_OSH_FILTER_TIME | _OSH_FILTER_BARRIERS)) &&
+      !_osh_window_pass(func_id, *start)) {
+    _osh_untraced(func_id, team);
+    return 0;
+  }
+  if (UNLIKELY(_osh_trace_mode & _OSH_TRACE_LIVE)) {
+    _osh_live_enter(func_id, *start);
+  }
+  return 1;
+}
+
+// 1 in N calls per function and thread, and only those slower than
+// OSH_TRACE_MIN_DURATION. this only decides whether the event is recorded,
+// the stats and the communication matrix still count every call
+_OSH_INLINE int _osh_sample(struct _osh_thread *t, uint32_t func_id,
+                            uint64_t duration) {
+  if (duration < _osh_min_ticks) {
+    return 0;
+  }
+  if (t->skip[func_id]) {
+    t->skip[func_id]--;
+    return 0;
+  }
+  t->skip[func_id] = _osh_fn_sample[func_id] - 1;
+  return 1;
+}
+
+// a collective_team event ahead of a collective on a team other than the
+// world: the team's start, stride and size in target_pe, bytes_rx and
+// bytes_tx, the collective's func_id in aux
+static _OSH_COLD void _osh_log_team(struct _osh_thread *t, uint32_t func_id,
+                                    uint64_t start, struct _osh_team team) {
+  struct _osh_event *ev = _osh_next_event(t);
+  if (ev) {
+    ev->start = start;
+    ev->duration = 0;
+    ev->bytes_rx = (uint64_t)(int64_t)team.stride;
+    ev->bytes_tx = (uint64_t)team.size;
+    ev->func_id = _OSH_FN_collective_team;
+    ev->target_pe = team.start;
+    ev->stack_id = _OSH_NO_STACK;
+    ev->aux = func_id;
+    _osh_commit_event(t->buffer);
+  }
+}
+
+// team is the one a collective is on, _osh_world() for everything else
+_OSH_INLINE void _osh_log_call(uint32_t func_id, struct _osh_team team,
+                               uint64_t duration, uint64_t start,
+                               int target_pe, size_t bytes_rx,
+                               size_t bytes_tx, char *extra) {
+  if (UNLIKELY(_osh_trace_mode == _OSH_TRACE_OFF)) {
+    return;
+  }
+  // every traced call, whatever sampling records
+  if (UNLIKELY(_osh_trace_mode & _OSH_TRACE_LIVE) &&
+      func_id >= _OSH_FN_FIRST_WRAPPED && func_id < _OSH_FN_nbi_complete) {
+    _osh_live_exit(func_id, start, duration, bytes_rx + bytes_tx);
+  }
+  // untraced calls take theirs in _osh_untraced
+  uint32_t seq = 0;
+  if (_osh_fn_collective(func_id)) {
+    seq = _osh_collective_next(func_id, team);
+  }
+  struct _osh_thread *t = _osh_self;
+  if (UNLIKELY(!t)) {
+    t = _osh_thread_register();
+    if (!t) {
+      return;
+    }
+  }
+
+  // func_id is a constant in every wrapper, so only the nbi and completing
+  // wrappers keep these branches. a completing call is logged with the
+  // bytes it retired and their count in aux, a collective with its sequence
+  // number instead
+  uint32_t aux = 0;
+  if (_osh_fn_completes_nbi(func_id) && t->nbi.count) {
+    aux = _osh_nbi_retire(t, start + duration, &bytes_rx, &bytes_tx);
+  } else if (_osh_trace_mode & _OSH_TRACE_COMM) {
+    _osh_comm_add(t->comm, target_pe, bytes_rx, bytes_tx);
+  }
+  if (_osh_fn_collective(func_id)) {
+    aux = seq;
+  }
+  if (_osh_trace_mode & (_OSH_TRACE_STATS | _OSH_TRACE_SUMMARY)) {
+    _osh_stats_add(&t->stats, func_id, duration, target_pe, bytes_rx,
+                   bytes_tx);
+  }
+
+  int record = 1;
+  if (UNLIKELY(_osh_filter & _OSH_FILTER_EVENTS)) {
+    record = _osh_sample(t, func_id, duration);
+  }
+
+  uint32_t stack_id = _OSH_NO_STACK;
+  if (UNLIKELY(!(_osh_trace_mode & _OSH_TRACE_BIN))) {
+    if ((_osh_trace_mode & _OSH_TRACE_CSV) && record) {
+      char seq_extra[64];
+      if (_osh_fn_collective(func_id) && team.size) {
+        snprintf(seq_extra, sizeof(seq_extra), "seq=%u;team=%d:%d:%d", seq,
+                 team.start, team.stride, team.size);
+        extra = seq_extra;
+      } else if (_osh_fn_collective(func_id)) {
+        snprintf(seq_extra, sizeof(seq_extra), "seq=%u", seq);
+        extra = seq_extra;
+      }
+      // captured here rather than in _osh_log_csv, so caller and fp see the
+      // same frames as in a binary trace
+      void *frames[_OSH_MAX_FRAMES];
+      int depth = _osh_capture_frames(frames);
+      _osh_log_csv(t->tid, func_id, duration, start, target_pe, bytes_rx,
+                   bytes_tx, frames, depth, extra);
+    }
+  } else if (record) {
+    if (_osh_fn_collective(func_id) && team.size) {
+      _osh_log_team(t, func_id, start, team);
+    }
+    struct _osh_event *ev = _osh_next_event(t);
+    if (ev) {
+      ev->start = start;
+      ev->duration = duration;
+      ev->bytes_rx = bytes_rx;
+      ev->bytes_tx = bytes_tx;
+      ev->func_id = func_id;
+      ev->target_pe = target_pe;
+      ev->stack_id = stack_id = _osh_capture_stack(&t->stacks, t->buffer);
+      ev->aux = aux;
+      _osh_commit_event(t->buffer);
+    }
+  }
+
+  // with sync compiled out nothing would ever retire them
+  if (OSH_TRACE_SYNC && _osh_fn_nbi[func_id] &&
+      (_osh_trace_mode & (_OSH_TRACE_BIN | _OSH_TRACE_CSV | _OSH_TRACE_STATS |
+                          _OSH_TRACE_SUMMARY))) {
+    _osh_nbi_issue(&t->nbi, func_id, start, target_pe, bytes_rx, bytes_tx,
+                   stack_id, record);
+  }
+}
+
+static _OSH_COLD int _osh_heap_init(struct _osh_heap *h) {
+  // never destroyed, a late shmem_free still takes it
+  pthread_mutex_init(&h->lock, NULL);
+  h->allocs = (struct _osh_alloc *)calloc(_OSH_HEAP_SLOTS, sizeof(*h->allocs));
+  if (!h->allocs) {
+    return -1;
+  }
+  if (_osh_stack_table_init(&h->site_stacks) != 0) {
+    free(h->allocs);
+    h->allocs = NULL;
+    return -1;
+  }
+  h->mask = _OSH_HEAP_SLOTS - 1;
+  return 0;
+}
+
+// under the lock, a shmem_free racing with shmem_finalize finds no table
+static _OSH_COLD void _osh_heap_free(struct _osh_heap *h) {
+  pthread_mutex_lock(&h->lock);
+  free(h->allocs);
+  free(h->sites);
+  _osh_stack_table_free(&h->site_stacks);
+  h->allocs = NULL;
+  h->sites = NULL;
+  h->count = h->cap_sites = 0;
+  h->live = h->peak = h->n_allocs = h->untracked = 0;
+  pthread_mutex_unlock(&h->lock);
+}
+
+_OSH_INLINE uint32_t _osh_heap_slot(uint64_t addr, uint32_t mask) {
+  return (uint32_t)((addr >> 4) * 0x9e3779b97f4a7c15ull >> 32) & mask;
+}
+
+// the slot holding addr, or the empty one where it would go
+_OSH_INLINE uint32_t _osh_heap_find(struct _osh_heap *h, uint64_t addr) {
+  uint32_t i = _osh_heap_slot(addr, h->mask);
+  while (h->allocs[i].addr != 0 && h->allocs[i].addr != addr) {
+    i = (i + 1) & h->mask;
+  }
+  return i;
+}
+
+// doubles the allocation table. -1 if there is no memory for it
+static _OSH_COLD int _osh_heap_grow(struct _osh_heap *h) {
+  uint32_t n = (h->mask + 1) * 2;
+  struct _osh_alloc *allocs =
+      n ? (struct _osh_alloc *)calloc(n, sizeof(*allocs)) : NULL;
+  if (!allocs) {
+    return -1;
+  }
+  for (uint32_t i = 0; i <= h->mask; i++) {
+    if (h->allocs[i].addr == 0) {
+      continue;
+    }
+    uint32_t j = _osh_heap_slot(h->allocs[i].addr, n - 1);
+    while (allocs[j].addr != 0) {
+      j = (j + 1) & (n - 1);
+    }
+    allocs[j] = h->allocs[i];
+  }
+  free(h->allocs);
+  h->allocs = allocs;
+  h->mask = n - 1;
+  return 0;
+}
+
+// the site id of these frames, interning them on first sight.
+// _OSH_NO_STACK if there is no memory for another
+static uint32_t _osh_heap_site(struct _osh_heap *h, void *const *frames,
+                               int depth) {
+  struct _osh_stack_table *t = &h->site_stacks;
+  uint64_t hash = _osh_hash_frames(frames, depth);
+  struct _osh_stack_slot *slot = _osh_stack_find(t, hash, frames, depth);
+  if (slot->hash != 0) {
+    return slot->id;
+  }
+
+  if (t->count == h->cap_sites) {
+    uint32_t cap = h->cap_sites ? h->cap_sites * 2 : 64;
+    struct _osh_heap_site *sites = (struct _osh_heap_site *)realloc(
+        h->sites, cap * sizeof(*sites));
+    if (!sites) {
+      return _OSH_NO_STACK;
+    }
+    h->sites = sites;
+    h->cap_sites = cap;
+  }
+  uint32_t id = _osh_stack_intern(t, slot, hash, frames, depth);
+  if (id != _OSH_NO_STACK) {
+    memset(&h->sites[id], 0, sizeof(h->sites[id]));
+  }
+  return id;
+}
+
+// takes addr out of the table into *out. the entries after it move back
+// into the hole if their probe sequence passes through it, so lookups never
+// need tombstones
+static int _osh_heap_remove(struct _osh_heap *h, uint64_t addr,
+                            struct _osh_alloc *out) {
+  uint32_t i = _osh_heap_slot(addr, h->mask);
+  while (h->allocs[i].addr != addr) {
+    if (h->allocs[i].addr == 0) {
+      return 0;
+    }
+    i = (i + 1) & h->mask;
+  }
+  *out = h->allocs[i];
+  for (uint32_t j = (i + 1) & h->mask; h->allocs[j].addr;
+       j = (j + 1) & h->mask) {
+    uint32_t home = _osh_heap_slot(h->allocs[j].addr, h->mask);
+    // j's entry may fill the hole at i unless its home lies in (i, j]
+    if (((j - home) & h->mask) >= ((j - i) & h->mask)) {
+      h->allocs[i] = h->allocs[j];
+      i = j;
+    }
+  }
+  h->allocs[i].addr = 0;
+  h->count--;
+  return 1;
+}
+
+// logs the heap's live bytes and high-water mark after func_id, as the
+// bytes_tx and bytes_rx of a heap_live event with func_id in aux
+static _OSH_COLD void _osh_heap_log(uint32_t func_id, uint64_t at,
+                                    uint64_t live, uint64_t peak) {
+  struct _osh_thread *t = _osh_self;
+  if (UNLIKELY(!t)) {
+    t = _osh_thread_register();
+    if (!t) {
+      return;
+    }
+  }
+  if (_osh_trace_mode & _OSH_TRACE_CSV) {
+    _osh_log_csv(t->tid, _OSH_FN_heap_live, 0, at, -1, peak, live, NULL, 0,
+                 (char *)_osh_fn_names[func_id]);
+  } else if (_osh_trace_mode & _OSH_TRACE_BIN) {
+    struct _osh_event *ev = _osh_next_event(t);
+    if (ev) {
+      ev->start = at;
+      ev->duration = 0;
+      ev->bytes_rx = peak;
+      ev->bytes_tx = live;
+      ev->func_id = _OSH_FN_heap_live;
+      ev->target_pe = -1;
+      ev->stack_id = _OSH_NO_STACK;
+      ev->aux = func_id;
+      _osh_commit_event(t->buffer);
+    }
+  }
+}
+
+// records `size` bytes at addr from the call stack in frames. the table is
+// kept at most 3/4 full, so every probe ends at an empty slot. once it can't
+// grow, new addresses are only counted
+static void _osh_heap_add(struct _osh_heap *h, uint64_t addr, uint64_t size,
+                          void *const *frames, int depth) {
+  uint32_t i = _osh_heap_find(h, addr);
+  if (h->allocs[i].addr == addr) {
+    // the same address twice means a free we never saw
+    h->live -= h->allocs[i].size;
+    if (h->allocs[i].site != _OSH_NO_STACK) {
+      h->sites[h->allocs[i].site].live -= h->allocs[i].size;
+      h->sites[h->allocs[i].site].live_allocs--;
+    }
+    h->count--;
+  } else if ((h->count + 1) * 4 > (h->mask + 1) * 3) {
+    if (_osh_heap_grow(h) != 0) {
+      h->untracked++;
+      return;
+    }
+    i = _osh_heap_find(h, addr);
+  }
+  uint32_t site = _osh_heap_site(h, frames, depth);
+  h->allocs[i].addr = addr;
+  h->allocs[i].size = size;
+  h->allocs[i].site = site;
+  h->count++;
+  h->n_allocs++;
+  h->live += size;
+  if (h->live > h->peak) {
+    h->peak = h->live;
+  }
+  if (site != _OSH_NO_STACK) {
+    struct _osh_heap_site *st = &h->sites[site];
+    st->live += size;
+    st->live_allocs++;
+    st->allocs++;
+    if (st->live > st->max_live) {
+      st->max_live = st->live;
+    }
+  }
+}
+
+// a symmetric heap call released `freed` and handed out `size` bytes at
+// `allocated` from the call stack in frames. either pointer may be NULL
+static __attribute__((noinline)) void
+_osh_heap_update(uint32_t func_id, void *freed, void *allocated,
+                 uint64_t size, void *const *frames, int depth) {
+  struct _osh_heap *h = &_osh_heap;
+  pthread_mutex_lock(&h->lock);
+  if (!h->allocs) {
+    pthread_mutex_unlock(&h->lock);
+    return;
+  }
+  struct _osh_alloc a;
+  if (freed && _osh_heap_remove(h, (uint64_t)(uintptr_t)freed, &a)) {
+    h->live -= a.size;
+    if (a.site != _OSH_NO_STACK) {
+      h->sites[a.site].live -= a.size;
+      h->sites[a.site].live_allocs--;
+    }
+  }
+  if (allocated) {
+    _osh_heap_add(h, (uint64_t)(uintptr_t)allocated, size, frames, depth);
+  }
+  // timed under the lock, so the counter's samples are in time order
+  uint64_t at = _osh_get_ticks();
+  uint64_t live = h->live;
+  uint64_t peak = h->peak;
+  pthread_mutex_unlock(&h->lock);
+
+  if ((_osh_trace_mode & (_OSH_TRACE_BIN | _OSH_TRACE_CSV)) &&
+      _osh_fn_sample[func_id]) {
+    _osh_heap_log(func_id, at, live, peak);
+  }
+}
+
+// a call site captured right in the wrapper, so the frames are the caller's
+_OSH_INLINE void _osh_heap_alloc(uint32_t func_id, void *freed, void *ret,
+                                 uint64_t size) {
+  void *frames[_OSH_MAX_FRAMES];
+  int depth = ret ? _osh_capture_frames(frames) : 0;
+  _osh_heap_update(func_id, freed, ret, size, frames, depth);
+}
+
+// what each symmetric heap call did to the heap, called by its wrapper
+// with the return value followed by the call's arguments
+_OSH_INLINE void _osh_heap_shmem_malloc(void *ret, size_t size) {
+  _osh_heap_alloc(_OSH_FN_shmem_malloc, NULL, ret, size);
+}
+
+_OSH_INLINE void _osh_heap_shmem_calloc(void *ret, size_t count, size_t size) {
+  _osh_heap_alloc(_OSH_FN_shmem_calloc, NULL, ret, (uint64_t)count * size);
+}
+
+// a failed realloc leaves ptr alone, a size of 0 frees it
+_OSH_INLINE void _osh_heap_shmem_realloc(void *ret, void *ptr, size_t size) {
+  _osh_heap_alloc(_OSH_FN_shmem_realloc, ret || !size ? ptr : NULL, ret, size);
+}
+
+_OSH_INLINE void _osh_heap_shmem_align(void *ret, size_t alignment,
+                                       size_t size) {
+  (void)alignment;
+  _osh_heap_alloc(_OSH_FN_shmem_align, NULL, ret, size);
+}
+
+_OSH_INLINE void _osh_heap_shmem_malloc_with_hints(void *ret, size_t size,
+                                                   long hints) {
+  (void)hints;
+  _osh_heap_alloc(_OSH_FN_shmem_malloc_with_hints, NULL, ret, size);
+}
+
+_OSH_INLINE void _osh_heap_shmem_free(void *ptr) {
+  if (ptr) {
+    _osh_heap_update(_OSH_FN_shmem_free, ptr, NULL, 0, NULL, 0);
+  }
+}
+
+static int _osh_heap_site_cmp(const void *a, const void *b) {
+  const struct _osh_heap_site *x = *(struct _osh_heap_site *const *)a;
+  const struct _osh_heap_site *y = *(struct _osh_heap_site *const *)b;
+  if (x->live != y->live) {
+    return x->live < y->live ? 1 : -1;
+  }
+  return x->max_live < y->max_live ? 1 : x->max_live > y->max_live ? -1 : 0;
+}
+
+// pheap.NNN.csv: what is still allocated at finalize, by call site, most
+// bytes first. the first row is the whole PE, its Max_Live_Bytes being the
+// high-water mark
+static _OSH_COLD void _osh_heap_dump(struct _osh_heap *h) {
+  pthread_mutex_lock(&h->lock);
+  char filename[32];
+  snprintf(filename, sizeof(filename), "pheap.%03d.csv", _osh_pe_id);
+  FILE *f = fopen(filename, "w");
+  uint32_t n_sites = h->site_stacks.count;
+  struct _osh_heap_site **sorted =
+      (struct _osh_heap_site **)malloc((n_sites + 1) * sizeof(*sorted));
+  if (!f || !sorted) {
+    perror("failed to write heap report");
+    if (f) {
+      fclose(f);
+    }
+    free(sorted);
+    pthread_mutex_unlock(&h->lock);
+    return;
+  }
+  for (uint32_t i = 0; i < n_sites; i++) {
+    sorted[i] = &h->sites[i];
+  }
+  qsort(sorted, n_sites, sizeof(*sorted), _osh_heap_site_cmp);
+
+  fprintf(f, "Live_Bytes,Live_Allocations,Max_Live_Bytes,Allocations,"
+             "Stacktrace\n");
+  fprintf(f, "%llu,%u,%llu,%llu,total\n", (unsigned long long)h->live,
+          h->count, (unsigned long long)h->peak,
+          (unsigned long long)h->n_allocs);
+  if (h->untracked) {
+    fprintf(f, "0,0,0,%llu,untracked\n", (unsigned long long)h->untracked);
+  }
+  for (uint32_t i = 0; i < n_sites; i++) {
+    struct _osh_heap_site *st = sorted[i];
+    const uint64_t *entry =
+        &h->site_stacks.words[h->site_stacks.offsets[st - h->sites]];
+    fprintf(f, "%llu,%u,%llu,%u,", (unsigned long long)st->live,
+            st->live_allocs, (unsigned long long)st->max_live, st->allocs);
+    for (uint64_t d = 0; d < entry[0]; d++) {
+      fprintf(f, "%p|", (void *)(uintptr_t)entry[1 + d]);
+    }
+    fputc('\n', f);
+  }
+  // symmetric allocations are collective, PE 0 speaks for everyone
+  if (_osh_pe_id == 0 && h->count) {
+    fprintf(stderr,
+            "OSH_TRACE: %u symmetric allocations (%llu bytes) not freed "
+            "before shmem_finalize, see %s\n",
+            h->count, (unsigned long long)h->live, filename);
+  }
+  if (h->untracked) {
+    fprintf(stderr,
+            "OSH_TRACE: PE %d ran out of memory for its heap table, %llu "
+            "symmetric allocations went untracked\n",
+            _osh_pe_id, (unsigned long long)h->untracked);
+  }
+  free(sorted);
+  fclose(f);
+  pthread_mutex_unlock(&h->lock);
+}
+
+#ifdef __linux__
+static int _osh_program_bias(struct dl_phdr_info *info, size_t size,
+                             void *data) {
+  (void)size;
+  *(uint64_t *)data = info->dlpi_addr;
+  return 1;
+}
+#endif
+
+static inline void _osh_host_info(char *host, size_t host_len,
+                                  uint64_t *slide_out) {
+  gethostname(host, host_len);
+  host[host_len - 1] = '\0';
+
+#ifdef __APPLE__
+  *slide_out = (uint64_t)_dyld_get_image_vmaddr_slide(0);
+#elif defined(__linux__)
+  // the program is the first object dl_iterate_phdr reports. the first line
+  // of /proc/self/maps is only its bias if nothing was mapped below it
+  *slide_out = 0;
+  dl_iterate_phdr(_osh_program_bias, slide_out);
+#else
+  *slide_out = 0;
+#endif
+}
+
+static _OSH_COLD void _osh_write_trailer(void) {
+  struct {
+    struct _osh_block blk;
+    struct _osh_trailer trailer;
+  } t;
+  t.trailer.events = __atomic_load_n(&_osh_events_written, __ATOMIC_RELAXED);
+  t.trailer.dropped = __atomic_load_n(&_osh_events_dropped, __ATOMIC_RELAXED);
+  t.trailer.end_tick = _osh_get_ticks();
+  t.trailer.clock = _osh_shifts[1];
+  _osh_write_block(&t.blk, _OSH_BLOCK_TRAILER, 0, sizeof(t.trailer));
+}
+
+// everything logged is in the file already. counts the events in the
+// threads' last segments, unmaps, and cuts the file back to the segments in
+// use so the trailer follows them
+static _OSH_COLD void _osh_mmap_close(void) {
+  struct _osh_mapping *m = &_osh_mapping;
+  for (struct _osh_thread *t = _osh_threads; t; t = t->next) {
+    _osh_events_written += t->buffer->n_events;
+    // the buffer points into the mapping, nothing to free
+    memset(t->buffer, 0, sizeof(*t->buffer));
+  }
+  munmap(m->base, m->reserved);
+  m->base = NULL;
+  if (ftruncate(_osh_trace_fd, (off_t)_osh_trace_offset) != 0) {
+    perror("failed to truncate trace file");
+  }
+  pthread_mutex_destroy(&m->lock);
+}
+
+// writes the events b has committed so far, and the stacks they use, from
+// copies: b's thread may still be logging into it
+static _OSH_COLD void _osh_write_committed(struct _osh_buffer *b) {
+  if (!b->events_blk) {
+    return;
+  }
+  // stacks are committed before the events referencing them
+  uint64_t events = __atomic_load_n(&b->events_blk->size, __ATOMIC_ACQUIRE);
+  uint64_t stacks = __atomic_load_n(&b->stacks_blk->size, __ATOMIC_ACQUIRE);
+  uint64_t len = stacks > events ? stacks : events;
+  struct _osh_block *blk = (struct _osh_block *)malloc(sizeof(*blk) + len);
+  if (!blk) {
+    __atomic_fetch_add(&_osh_events_dropped,
+                       events / sizeof(struct _osh_event), __ATOMIC_RELAXED);
+    return;
+  }
+  int stacks_failed = 0;
+  if (stacks) {
+    memcpy(blk + 1, b->stacks, stacks);
+    stacks_failed = _osh_write_block(blk, _OSH_BLOCK_STACKS, b->tid, stacks);
+  }
+  if (events) {
+    memcpy(blk + 1, b->events, events);
+    uint64_t n = events / sizeof(struct _osh_event);
+    // events whose stacks are not in the file are of no use
+    if (stacks_failed ||
+        _osh_write_block(blk, _OSH_BLOCK_EVENTS, b->tid, events)) {
+      __atomic_fetch_add(&_osh_events_dropped, n, __ATOMIC_RELAXED);
+    } else {
+      __atomic_fetch_add(&_osh_events_written, n, __ATOMIC_RELAXED);
+    }
+  }
+  free(blk);
+}
+
+// the trace file at exit, without finalize. other threads may still be
+// inside calls, logging into their buffers, so they keep those: this writes
+// what is committed, and from here on whatever would go to the file is
+// dropped instead
+static _OSH_COLD void _osh_exit_flush(void) {
+  pthread_rwlock_wrlock(&_osh_sink_lock);
+  _osh_sink_closed = 1;
+  pthread_rwlock_unlock(&_osh_sink_lock);
+  struct _osh_thread *head = __atomic_load_n(&_osh_threads, __ATOMIC_ACQUIRE);
+
+  if (_osh_trace_async) {
+    // the buffers already handed over
+    _osh_writer_stop(0);
+  }
+#ifdef O_DIRECT
+  if (_osh_writer.direct) {
+    fcntl(_osh_trace_fd, F_SETFL, fcntl(_osh_trace_fd, F_GETFL) & ~O_DIRECT);
+    _osh_writer.direct = 0;
+  }
+#endif
+
+  if (_osh_mapping.base) {
+    // in the file already, up to the last claimed segment. the mapping
+    // stays for the threads still writing to it
+    struct _osh_mapping *m = &_osh_mapping;
+    for (struct _osh_thread *t = head; t; t = t->next) {
+      if (t->buffer->events_blk) {
+        _osh_events_written +=
+            __atomic_load_n(&t->buffer->events_blk->size, __ATOMIC_ACQUIRE) /
+            sizeof(struct _osh_event);
+      }
+    }
+    pthread_mutex_lock(&m->lock);
+    if (ftruncate(_osh_trace_fd, (off_t)_osh_trace_offset) != 0) {
+      perror("failed to truncate trace file");
+    }
+    m->size = _osh_trace_offset;
+    pthread_mutex_unlock(&m->lock);
+    return;
+  }
+  for (struct _osh_thread *t = head; t; t = t->next) {
+    _osh_write_committed(t->buffer);
+  }
+}
+
+// final is set at finalize, where the calling thread is the last one making
+// calls. at exit other threads may still be inside a wrapper, so this leaves
+// them their buffers, the mapping and the tables they log into
+static _OSH_COLD void _osh_trace_close(int final) {
+  int mode = _osh_trace_mode;
+  if (mode == _OSH_TRACE_OFF) {
+    return;
+  }
+  // new calls go straight to pshmem from here, but one already past that
+  // check still logs its event
+  _osh_trace_mode = _OSH_TRACE_OFF;
+  if (mode & _OSH_TRACE_LIVE) {
+    _osh_live_close();
+  }
+
+  // the per-thread tables are only still at exit when nothing else is logging
+  // into them
+  if ((mode & _OSH_TRACE_STATS) &&
+      (final || __atomic_load_n(&_osh_n_threads, __ATOMIC_ACQUIRE) <= 1)) {
+    struct _osh_stats_table stats;
+    if (_osh_stats_collect(&stats) == 0) {
+      _osh_stats_dump(&stats);
+    }
+    _osh_stats_free(&stats);
+  }
+  // with a summary PE 0 already wrote the whole matrix
+  if ((mode & _OSH_TRACE_COMM) && !(mode & _OSH_TRACE_SUMMARY)) {
+    uint64_t *comm = _osh_comm_collect();
+    if (comm) {
+      _osh_comm_dump(comm);
+    }
+    free(comm);
+  }
+  if (mode & _OSH_TRACE_HEAP) {
+    _osh_heap_dump(&_osh_heap);
+  }
+  if ((mode & _OSH_TRACE_CSV) && _osh_profile_log) {
+    fflush(_osh_profile_log);
+  }
+  if (!final) {
+    if ((mode & _OSH_TRACE_BIN) && _osh_trace_fd != -1) {
+      _osh_exit_flush();
+      _osh_write_trailer();
+    }
+    return;
+  }
+
+  if (mode & _OSH_TRACE_HEAP) {
+    _osh_heap_free(&_osh_heap);
+  }
+  pthread_mutex_lock(&_osh_team_seqs.lock);
+  free(_osh_team_seqs.slots);
+  _osh_team_seqs.slots = NULL;
+  pthread_mutex_unlock(&_osh_team_seqs.lock);
+  if ((mode & _OSH_TRACE_CSV) && _osh_profile_log) {
+    fclose(_osh_profile_log);
+    _osh_profile_log = NULL;
+  }
+  if ((mode & _OSH_TRACE_BIN) && _osh_trace_fd != -1) {
+    // every thread's events end up in this PE's file
+    if (_osh_mapping.base) {
+      _osh_mmap_close();
+    } else if (_osh_trace_async) {
+      _osh_writer_stop(1);
+      _osh_trace_async = 0;
+    } else {
+      for (struct _osh_thread *t = _osh_threads; t; t = t->next) {
+        _osh_flush(t);
+      }
+    }
+#ifdef O_DIRECT
+    if (_osh_writer.direct) {
+      fcntl(_osh_trace_fd, F_SETFL,
+            fcntl(_osh_trace_fd, F_GETFL) & ~O_DIRECT);
+      _osh_writer.direct = 0;
+    }
+#endif
+    _osh_write_trailer();
+
+    close(_osh_trace_fd);
+    _osh_trace_fd = -1;
+  }
+
+  struct _osh_thread *t = _osh_threads;
+  while (t) {
+    struct _osh_thread *next = t->next;
+    _osh_thread_free(t);
+    t = next;
+  }
+  _osh_threads = NULL;
+  _osh_n_threads = 0;
+  _osh_self = NULL;
+}
+
+static void _osh_trace_atexit(void) { _osh_trace_close(0); }
+
+// OSH_TRACE_STACK=backtrace[:depth] (default) | caller | fp[:depth] | off
+static _OSH_COLD void _osh_parse_stack_mode(void) {
+  const char *env = getenv("OSH_TRACE_STACK");
+  _osh_stack_mode = _OSH_STACK_BACKTRACE;
+  _osh_stack_depth = _OSH_DEFAULT_FRAMES;
+  if (!env) {
+    return;
+  }
+
+  if (strncmp(env, "caller", 6) == 0) {
+    _osh_stack_mode = _OSH_STACK_CALLER;
+    _osh_stack_depth = 1;
+    return;
+  } else if (strncmp(env, "fp", 2) == 0) {
+    _osh_stack_mode = _OSH_STACK_FP;
+  } else if (strncmp(env, "off", 3) == 0) {
+    _osh_stack_mode = _OSH_STACK_OFF;
+    return;
+  } else if (strncmp(env, "backtrace", 9) != 0) {
+    fprintf(stderr, "unknown OSH_TRACE_STACK=%s, using backtrace\n", env);
+  }
+
+  const char *depth = strchr(env, ':');
+  if (depth) {
+    _osh_stack_depth = atoi(depth + 1);
+    if (_osh_stack_depth < 1 || _osh_stack_depth > _OSH_MAX_FRAMES) {
+      _osh_stack_depth = _OSH_DEFAULT_FRAMES;
+    }
+  }
+}
+
+// maps the trace file, which holds the header and function names so far.
+// OSH_TRACE_MMAP_MAX caps its size in MiB; once that is reached, events
+// are dropped
+static _OSH_COLD int _osh_mmap_open(void) {
+  struct _osh_mapping *m = &_osh_mapping;
+  const char *env = getenv("OSH_TRACE_MMAP_MAX");
+  m->reserved = env ? (uint64_t)atol(env) << 20 : _OSH_MMAP_DEFAULT_MAX;
+  // a segment holds as many events as a buffer would
+  m->segment = ((uint64_t)_osh_buffer_events * sizeof(struct _osh_event) +
+                sizeof(struct _osh_block) + _OSH_DIRECT_ALIGN - 1) &
+               ~(uint64_t)(_OSH_DIRECT_ALIGN - 1);
+
+  struct {
+    struct _osh_block blk;
+    struct _osh_segments seg;
+  } h;
+  h.seg.first = (_osh_trace_offset + sizeof(h) + _OSH_DIRECT_ALIGN - 1) &
+                ~(uint64_t)(_OSH_DIRECT_ALIGN - 1);
+  h.seg.size = m->segment;
+  if (h.seg.first + m->segment > m->reserved) {
+    fprintf(stderr, "OSH_TRACE_MMAP_MAX is too small for one segment\n");
+    return -1;
+  }
+
+  void *base = mmap(NULL, m->reserved, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    _osh_trace_fd, 0);
+  if (base == MAP_FAILED) {
+    perror("failed to map trace file, writing it instead");
+    return -1;
+  }
+  _osh_write_block(&h.blk, _OSH_BLOCK_SEGMENTS, 0, sizeof(h.seg));
+
+  pthread_mutex_init(&m->lock, NULL);
+  m->base = (char *)base;
+  m->size = _osh_trace_offset;
+  _osh_trace_offset = h.seg.first;
+  return 0;
+}
+
+static _OSH_COLD int _osh_trace_open_bin(void) {
+  const char *env = getenv("OSH_TRACE_BUFFER");
+  long cap = env ? atol(env) : _OSH_DEFAULT_BUFFER_EVENTS;
+  if (cap < 1) {
+    cap = _OSH_DEFAULT_BUFFER_EVENTS;
+  }
+  // each thread allocates its own buffers on its first call
+  _osh_buffer_events = (uint32_t)cap;
+  env = getenv("OSH_TRACE_ASYNC");
+  _osh_trace_async = env && atoi(env) != 0;
+
+  // OSH_TRACE_PER_NODE=1: the PEs on a node append to one shared file. each
+  // block is a single write and carries its PE, which bin_to_csv.py uses to
+  // split the file again. otherwise blocks from this PE's threads each get
+  // their own range of the file
+  env = getenv("OSH_TRACE_PER_NODE");
+  int per_node = env && atoi(env) != 0;
+  _osh_trace_append = per_node;
+  _osh_trace_offset = 0;
+  char filename[96];
+  if (per_node) {
+    char host[64];
+    gethostname(host, sizeof(host));
+    host[sizeof(host) - 1] = '\0';
+    snprintf(filename, sizeof(filename), "pperf.%s.bin", host);
+    // the first PE on the node truncates, the rest wait for it
+    if (pshmem_team_my_pe(SHMEM_TEAM_SHARED) == 0) {
+      _osh_trace_fd =
+          open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+      pshmem_barrier_all();
+    } else {
+      pshmem_barrier_all();
+      _osh_trace_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+  } else {
+    snprintf(filename, sizeof(filename), "pperf.%03d.bin", _osh_pe_id);
+    // read as well, for mapping it
+    _osh_trace_fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  }
+  if (_osh_trace_fd == -1) {
+    perror("failed to open log file");
+    return -1;
+  }
+
+  struct {
+    struct _osh_block blk;
+    struct _osh_header hdr;
+  } h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.hdr.magic, _OSH_TRACE_MAGIC, sizeof(h.hdr.magic));
+  h.hdr.version = _OSH_TRACE_VERSION;
+  h.hdr.event_size = sizeof(struct _osh_event);
+  h.hdr.pe = _osh_pe_id;
+  h.hdr.n_pes = pshmem_n_pes();
+  h.hdr.tick_origin = _osh_start;
+  h.hdr.ns_per_tick = _osh_ns_per_tick;
+  h.hdr.origin_ns = _osh_ticks_to_ns(_osh_start);
+  _osh_host_info(h.hdr.host, sizeof(h.hdr.host), &h.hdr.slide);
+  h.hdr.clock = _osh_shifts[0];
+  _osh_write_block(&h.blk, _OSH_BLOCK_HEADER, 0, sizeof(h.hdr));
+
+  size_t names_len = 0;
+  for (int i = 0; i < _OSH_FN_COUNT; i++) {
+    names_len += strlen(_osh_fn_names[i]) + 1;
+  }
+  struct _osh_block *names_blk =
+      (struct _osh_block *)malloc(sizeof(struct _osh_block) + names_len);
+  if (names_blk) {
+    char *p = (char *)(names_blk + 1);
+    for (int i = 0; i < _OSH_FN_COUNT; i++) {
+      size_t len = strlen(_osh_fn_names[i]) + 1;
+      memcpy(p, _osh_fn_names[i], len);
+      p += len;
+    }
+    _osh_write_block(names_blk, _OSH_BLOCK_FUNCS, 0, names_len);
+    free(names_blk);
+  }
+  _osh_write_modules();
+
+  env = getenv("OSH_TRACE_MMAP");
+  if (env && atoi(env) != 0) {
+    // the PEs sharing a file can't share one mapping's offsets
+    if (per_node) {
+      fprintf(stderr, "OSH_TRACE_MMAP is ignored with OSH_TRACE_PER_NODE\n");
+    } else if (_osh_mmap_open() == 0) {
+      _osh_trace_async = 0;
+    }
+  }
+
+  if (_osh_trace_async) {
+#ifdef O_DIRECT
+    // bypass the page cache for the bulk writes unless OSH_TRACE_DIRECT=0.
+    // not every filesystem supports it, in which case we stay buffered.
+    // appends from several PEs can't be kept aligned, so not per node
+    env = getenv("OSH_TRACE_DIRECT");
+    if (!per_node && (!env || atoi(env) != 0)) {
+      _osh_align_file();
+      int flags = fcntl(_osh_trace_fd, F_GETFL);
+      _osh_writer.direct =
+          fcntl(_osh_trace_fd, F_SETFL, flags | O_DIRECT) == 0;
+    }
+#endif
+    if (_osh_writer_start() != 0) {
+      _osh_trace_async = 0;
+    }
+  }
+  return 0;
+}
+
+// OSH_TRACE_MODE, comma separated: bin (default) | csv | stats | summary |
+// comm | heap | off
+static _OSH_COLD int _osh_parse_mode_list(const char *env) {
+  int mode = _OSH_TRACE_OFF;
+  while (*env) {
+    size_t len = strcspn(env, ",");
+    if (len == 3 && strncmp(env, "bin", 3) == 0) {
+      mode = (mode & ~_OSH_TRACE_CSV) | _OSH_TRACE_BIN;
+    } else if (len == 3 && strncmp(env, "csv", 3) == 0) {
+      mode = (mode & ~_OSH_TRACE_BIN) | _OSH_TRACE_CSV;
+    } else if (len == 5 && strncmp(env, "stats", 5) == 0) {
+      mode |= _OSH_TRACE_STATS;
+    } else if (len == 7 && strncmp(env, "summary", 7) == 0) {
+      mode |= _OSH_TRACE_SUMMARY;
+    } else if (len == 4 && strncmp(env, "comm", 4) == 0) {
+      mode |= _OSH_TRACE_COMM;
+    } else if (len == 4 && strncmp(env, "heap", 4) == 0) {
+      mode |= _OSH_TRACE_HEAP;
+    } else if (len == 4 && strncmp(env, "live", 4) == 0) {
+      mode |= _OSH_TRACE_LIVE;
+    } else if (!(len == 3 && strncmp(env, "off", 3) == 0)) {
+      fprintf(stderr, "unknown OSH_TRACE_MODE entry %.*s\n", (int)len, env);
+    }
+    env += len;
+    env += *env == ',';
+  }
+  return mode;
+}
+
+// OSH_TRACE_MODE, plus the communication matrix unless OSH_TRACE_COMM=0 and
+// heap tracking with OSH_TRACE_HEAP=1
+static _OSH_COLD int _osh_parse_trace_mode(void) {
+  const char *env = getenv("OSH_TRACE_MODE");
+  int mode = _OSH_TRACE_BIN;
+  if (env) {
+    mode = _osh_parse_mode_list(env);
+  }
+  // the communication matrix is cheap enough to keep whenever tracing is
+  // on, OSH_TRACE_COMM=0 turns it off
+  env = getenv("OSH_TRACE_COMM");
+  if (mode != _OSH_TRACE_OFF && !(env && atoi(env) == 0)) {
+    mode |= _OSH_TRACE_COMM;
+  }
+  // the heap map takes a lock and a stack per allocation, and reports leaks
+  // on stderr, so it is only kept when asked for
+  env = getenv("OSH_TRACE_HEAP");
+  if (mode != _OSH_TRACE_OFF && env && atoi(env) != 0) {
+    mode |= _OSH_TRACE_HEAP;
+  }
+  return mode;
+}
+
+// sets _osh_fn_sample to value for every wrapped function matching the first
+// len chars of pattern, which is a class name or a shell pattern on the
+// function name. with keep_off, functions that are off stay off
+static _OSH_COLD void _osh_filter_set(const char *pattern, size_t len,
+                                      uint32_t value, int keep_off) {
+  char pat[128];
+  len = len < sizeof(pat) ? len : sizeof(pat) - 1;
+  memcpy(pat, pattern, len);
+  pat[len] = '\0';
+
+  int cls = -1;
+  for (int c = 0; c < _OSH_CLASS_COUNT; c++) {
+    if (strcmp(pat, _osh_class_names[c]) == 0) {
+      cls = c;
+    }
+  }
+  int matched = 0;
+  for (uint32_t fn = _OSH_FN_FIRST_WRAPPED; fn < _OSH_FN_nbi_complete; fn++) {
+    if (cls >= 0 ? _osh_fn_class(fn) != cls
+                 : fnmatch(pat, _osh_fn_names[fn], 0) != 0) {
+      continue;
+    }
+    if (!keep_off || _osh_fn_sample[fn] != 0) {
+      _osh_fn_sample[fn] = value;
+    }
+    matched++;
+  }
+  if (!matched && _osh_pe_id == 0) {
+    fprintf(stderr, "OSH_TRACE: %s matches no function\n", pat);
+  }
+}
+
+// comma separated names, shell patterns and classes
+static _OSH_COLD void _osh_filter_list(const char *env, uint32_t value) {
+  while (*env) {
+    size_t len = strcspn(env, ",");
+    if (len) {
+      _osh_filter_set(env, len, value, 0);
+    }
+    env += len;
+    env += *env == ',';
+  }
+}
+
+// OSH_TRACE_SAMPLE=N[,pattern:N]...: record 1 in N calls, of every
+// function or of the ones matching pattern. later entries win
+static _OSH_COLD void _osh_filter_sample(const char *env) {
+  while (*env) {
+    size_t len = strcspn(env, ",");
+    const char *colon = (const char *)memchr(env, ':', len);
+    long n = atol(colon ? colon + 1 : env);
+    if (n < 1) {
+      if (_osh_pe_id == 0) {
+        fprintf(stderr, "bad OSH_TRACE_SAMPLE entry %.*s\n", (int)len, env);
+      }
+    } else if (colon) {
+      _osh_filter_set(env, (size_t)(colon - env), (uint32_t)n, 1);
+    } else {
+      _osh_filter_set("*", 1, (uint32_t)n, 1);
+    }
+    env += len;
+    env += *env == ',';
+  }
+}
+
+// "begin:end", either may be left out. end is -1 if it is
+static _OSH_COLD void _osh_parse_window(const char *env, double *begin,
+                                        double *end) {
+  const char *colon = strchr(env, ':');
+  *begin = colon == env ? 0 : atof(env);
+  *end = colon && colon[1] ? atof(colon + 1) : -1;
+}
+
+static _OSH_COLD uint64_t _osh_sec_to_ticks(double sec) {
+  double ticks = sec * 1e9 / _osh_ns_per_tick;
+  return ticks < (double)(UINT64_MAX - _osh_start) ? (uint64_t)ticks
+                                                   : UINT64_MAX - _osh_start;
+}
+
+// which calls get traced, read once in shmem_init. everything not set here
+// costs nothing in the wrappers:
+//   OSH_TRACE_FUNCS=list           trace only these names, patterns, classes
+//   OSH_TRACE_EXCLUDE=list         never trace these
+//   OSH_TRACE_SAMPLE=N[,pat:N]     record 1 in N calls per function
+//   OSH_TRACE_MIN_DURATION=us      record only calls at least this slow
+//   OSH_TRACE_WINDOW=s:s           trace from/until seconds after init
+//   OSH_TRACE_BARRIER_WINDOW=n:n   trace from/until n barriers
+static _OSH_COLD void _osh_parse_filters(void) {
+  for (uint32_t fn = 0; fn < _OSH_FN_COUNT; fn++) {
+    _osh_fn_sample[fn] = 1;
+  }
+  const char *env = getenv("OSH_TRACE_FUNCS");
+  if (env) {
+    for (uint32_t fn = _OSH_FN_FIRST_WRAPPED; fn < _OSH_FN_nbi_complete;
+         fn++) {
+      _osh_fn_sample[fn] = 0;
+    }
+    _osh_filter_list(env, 1);
+  }
+  env = getenv("OSH_TRACE_EXCLUDE");
+  if (env) {
+    _osh_filter_list(env, 0);
+  }
+  env = getenv("OSH_TRACE_SAMPLE");
+  if (env) {
+    _osh_filter_sample(env);
+  }
+
+  int filter = 0;
+  for (uint32_t fn = 0; fn < _OSH_FN_COUNT; fn++) {
+    _osh_fn_traced[fn] = _osh_fn_sample[fn] != 0;
+    if (_osh_fn_sample[fn] > 1) {
+      filter |= _OSH_FILTER_EVENTS;
+    }
+  }
+  env = getenv("OSH_TRACE_MIN_DURATION");
+  _osh_min_ticks = env ? _osh_sec_to_ticks(atof(env) / 1e6) : 0;
+  if (_osh_min_ticks) {
+    filter |= _OSH_FILTER_EVENTS;
+  }
+
+  double begin, end;
+  env = getenv("OSH_TRACE_WINDOW");
+  if (env) {
+    _osh_parse_window(env, &begin, &end);
+    _osh_window[0] = begin > 0 ? _osh_start + _osh_sec_to_ticks(begin) : 0;
+    _osh_window[1] = end >= 0 ? _osh_start + _osh_sec_to_ticks(end)
+                              : UINT64_MAX;
+    filter |= _OSH_FILTER_TIME;
+  }
+  env = getenv("OSH_TRACE_BARRIER_WINDOW");
+  if (env) {
+    _osh_parse_window(env, &begin, &end);
+    _osh_barrier_window[0] = begin > 0 ? (uint64_t)begin : 0;
+    _osh_barrier_window[1] = end >= 0 ? (uint64_t)end : UINT64_MAX;
+    filter |= _OSH_FILTER_BARRIERS;
+  }
+  _osh_barriers = 0;
+  _osh_filter = filter;
+}
+
+// a csv trace keeps the clock shifts in the Extra of init and finalize
+static _OSH_COLD void _osh_clock_extra(char *extra, size_t len,
+                                       const struct _osh_clock_shift *c) {
+  snprintf(extra, len, ";clock_shift=%lld;clock_at=%llu;clock_rtt=%llu",
+           (long long)c->shift, (unsigned long long)c->at,
+           (unsigned long long)c->rtt);
+}
+
+// returns the extra info for the shmem_init row
+static _OSH_COLD int _osh_trace_open_csv(char *extra_info, size_t len) {
+  char filename[32];
+  snprintf(filename, sizeof(filename), "pperf.%03d.csv", _osh_pe_id);
+  _osh_profile_log = fopen(filename, "w");
+  if (!_osh_profile_log) {
+    perror("failed to open log file");
+    return -1;
+  }
+
+  fprintf(_osh_profile_log, "Time,Function,Duration_Sec,Target_PE,Bytes_RX,"
+                            "Bytes_TX,Thread,Stacktrace,Extra\n");
+  char hostname[64];
+  uint64_t slide;
+  _osh_host_info(hostname, sizeof(hostname), &slide);
+#if defined(__APPLE__) || defined(__linux__)
+  int n = snprintf(extra_info, len, "host=%s;slide=%p", hostname,
+                   (void *)(uintptr_t)slide);
+#else
+  int n = snprintf(extra_info, len, "host=%s", hostname);
+#endif
+  if (_osh_shifts[0].rtt && n > 0 && (size_t)n < len) {
+    _osh_clock_extra(extra_info + n, len - (size_t)n, &_osh_shifts[0]);
+  }
+  return 0;
+}
+
+// with tracing off a wrapper doesn't even read the clock, see
+// _osh_trace_begin for calls the filters reject. TEAM is the team a
+// collective is on. HOOK runs after the call, traced or not, as
+// HOOK(FN_NAME, [ret,] arguments...)
+#define _OSH_WRAP_VOID(HOOK, TEAM, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)  \
+  _OSH_INLINE void FN_NAME DECL_ARGS {                                         \
+    if (UNLIKELY(_osh_trace_mode == _OSH_TRACE_OFF)) {                         \
+      p##FN_NAME CALL_ARGS;                                                    \
+      return;                                                                  \
+    }                                                                          \
+    struct _osh_team team_id = TEAM;                                           \
+    uint64_t start_t = 0;                                                      \
+    int traced = _osh_trace_begin(_OSH_FN_##FN_NAME, team_id, &start_t);       \
+    p##FN_NAME CALL_ARGS;                                                      \
+    if (traced) {                                                              \
+      uint64_t end_t = _osh_get_ticks();                                       \
+      _osh_log_call(_OSH_FN_##FN_NAME, team_id, end_t - start_t, start_t, PE,  \
+                    RX, TX, NULL);                                             \
+    }                                                                          \
+    HOOK(FN_NAME, _OSH_HOOK_ARGS CALL_ARGS);                                   \
+  }
+
+#define _OSH_WRAP_RET(HOOK, TEAM, RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, \
+                      RX, TX)                                                  \
+  _OSH_INLINE RET_TYPE FN_NAME DECL_ARGS {                                     \
+    if (UNLIKELY(_osh_trace_mode == _OSH_TRACE_OFF)) {                         \
+      return p##FN_NAME CALL_ARGS;                                             \
+    }                                                                          \
+    struct _osh_team team_id = TEAM;                                           \
+    uint64_t start_t = 0;                                                      \
+    int traced = _osh_trace_begin(_OSH_FN_##FN_NAME, team_id, &start_t);       \
+    RET_TYPE ret = p##FN_NAME CALL_ARGS;                                       \
+    if (traced) {                                                              \
+      uint64_t end_t = _osh_get_ticks();                                       \
+      _osh_log_call(_OSH_FN_##FN_NAME, team_id, end_t - start_t, start_t, PE,  \
+                    RX, TX, NULL);                                             \
+    }                                                                          \
+    HOOK(FN_NAME, ret, _OSH_HOOK_ARGS CALL_ARGS);                              \
+    return ret;                                                                \
+  }
+
+#define _OSH_HOOK_ARGS(...) __VA_ARGS__
+#define _OSH_NO_HOOK(FN_NAME, ...)
+
+// the symmetric heap wrappers also keep _osh_heap up to date, each through
+// _osh_heap_<function>(return value, arguments...)
+#define _OSH_HEAP_HOOK(FN_NAME, ...)                                           \
+  if (_osh_trace_mode & _OSH_TRACE_HEAP) {                                     \
+    _osh_heap_##FN_NAME(__VA_ARGS__);                                          \
+  }
+
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)              \
+  _OSH_WRAP_VOID(_OSH_NO_HOOK, _osh_world(), FN_NAME, DECL_ARGS, CALL_ARGS,    \
+                 PE, RX, TX)
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)     \
+  _OSH_WRAP_RET(_OSH_NO_HOOK, _osh_world(), RET_TYPE, FN_NAME, DECL_ARGS,      \
+                CALL_ARGS, PE, RX, TX)
+#undef WRAP_CALL_TEAM_VOID
+#undef WRAP_CALL_TEAM_RET
+#define WRAP_CALL_TEAM_VOID(TEAM, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)   \
+  _OSH_WRAP_VOID(_OSH_NO_HOOK, TEAM, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX,    \
+                 TX)
+#define WRAP_CALL_TEAM_RET(TEAM, RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE,  \
+                           RX, TX)                                             \
+  _OSH_WRAP_RET(_OSH_NO_HOOK, TEAM, RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS,   \
+                PE, RX, TX)
+
+// everything shmem_init and shmem_init_thread do once pshmem is up. func_id
+// is whichever of them was called
+static _OSH_COLD void _osh_trace_init(uint32_t func_id, uint64_t start_t,
+                                      uint64_t end_t) {
+  _osh_clock_calibrate();
+
+  _osh_pe_id = pshmem_my_pe();
+  if (_osh_pe_id == -1) {
+    return;
+  }
+
+  int mode = _osh_parse_trace_mode();
+  // OSH_TRACE_CLOCK_SYNC=rounds, 0 to skip it. collective, so every PE has
+  // to agree on it and on whether it traces events at all
+  if (mode & (_OSH_TRACE_BIN | _OSH_TRACE_CSV)) {
+    const char *env = getenv("OSH_TRACE_CLOCK_SYNC");
+    _osh_sync_rounds = env ? atoi(env) : _OSH_SYNC_ROUNDS;
+    if (_osh_sync_rounds > 0) {
+      _osh_clock_sync(&_osh_shifts[0]);
+    }
+  }
+
+  // the event traces' stacks and the heap's call sites
+  if (mode & (_OSH_TRACE_BIN | _OSH_TRACE_CSV | _OSH_TRACE_HEAP)) {
+    _osh_parse_stack_mode();
+  }
+
+  char extra_info[256] = "";
+  if ((mode & _OSH_TRACE_CSV) && _osh_trace_open_csv(extra_info,
+                                                     sizeof(extra_info))) {
+    mode &= ~_OSH_TRACE_CSV;
+  }
+  if ((mode & _OSH_TRACE_BIN) && _osh_trace_open_bin() != 0) {
+    mode &= ~_OSH_TRACE_BIN;
+  }
+  if (mode & _OSH_TRACE_COMM) {
+    _osh_comm_pes = (uint32_t)pshmem_n_pes();
+  }
+  if ((mode & _OSH_TRACE_HEAP) && _osh_heap_init(&_osh_heap) != 0) {
+    mode &= ~_OSH_TRACE_HEAP;
+  }
+  // collective like the summary, every PE has to ask for it
+  if ((mode & _OSH_TRACE_LIVE) && _osh_live_open() != 0) {
+    mode &= ~_OSH_TRACE_LIVE;
+  }
+  // the summary is collective, so this PE takes part even if it has nothing
+  // to contribute. remember what was asked for, not what succeeded
+  if (mode & _OSH_TRACE_SUMMARY) {
+    _osh_summary = mode & (_OSH_TRACE_SUMMARY | _OSH_TRACE_COMM);
+  }
+  _osh_trace_mode = mode;
+  if (mode == _OSH_TRACE_OFF) {
+    return;
+  }
+
+  // the calling thread is always thread 0. init is logged before the
+  // filters are in place, so it always is
+  _osh_log_call(func_id, _osh_world(), end_t - start_t, start_t, -1, 0, 0,
+                extra_info);
+  _osh_parse_filters();
+
+  // flush whatever is buffered if the program never reaches shmem_finalize
+  atexit(_osh_trace_atexit);
+}
+
+static inline void shmem_init(void) {
+  _osh_clock_init();
+  uint64_t start_t = _osh_get_ticks();
+
+  pshmem_init();
+  // APPROXIMATELY start of program
+  // this results in shmem_init starting at negative
+  // time, which is ok i guess
+  _osh_start = _osh_get_ticks();
+
+  uint64_t end_t = _osh_get_ticks();
+  _osh_trace_init(_OSH_FN_shmem_init, start_t, end_t);
+}
+
+static inline int shmem_init_thread(int requested, int *provided) {
+  _osh_clock_init();
+  uint64_t start_t = _osh_get_ticks();
+
+  int ret = pshmem_init_thread(requested, provided);
+  _osh_start = _osh_get_ticks();
+
+  uint64_t end_t = _osh_get_ticks();
+  if (ret == 0) {
+    _osh_trace_init(_OSH_FN_shmem_init_thread, start_t, end_t);
+  }
+  return ret;
+}
+
+static inline void shmem_finalize(void) {
+  if (_osh_summary) {
+    // an empty table if this fails, the reduction still needs this PE
+    struct _osh_stats_table stats;
+    _osh_stats_collect(&stats);
+    _osh_stats_reduce(&stats);
+    _osh_stats_free(&stats);
+    if (_osh_summary & _OSH_TRACE_COMM) {
+      uint64_t *comm = _osh_comm_collect();
+      _osh_comm_gather(comm);
+      free(comm);
+    }
+    _osh_summary = 0;
+  }
+
+  // the second measurement, for the drift since init
+  char extra[128] = "";
+  if (_osh_sync_rounds > 0) {
+    _osh_clock_sync(&_osh_shifts[1]);
+    if (_osh_shifts[1].rtt) {
+      _osh_clock_extra(extra, sizeof(extra), &_osh_shifts[1]);
+    }
+  }
+
+  uint64_t start_t = _osh_get_ticks();
+
+  pshmem_finalize();
+
+  uint64_t end_t = _osh_get_ticks();
+
+  // finalize is always logged, it marks the end of the trace
+  _osh_filter = 0;
+  _osh_log_call(_OSH_FN_shmem_finalize, _osh_world(), end_t - start_t,
+                start_t, -1, 0, 0, extra[0] ? extra + 1 : NULL);
+
+  _osh_trace_close(1);
+}
+
+#if OSH_TRACE_RMA
+_OSH_RMA_FUNCTIONS
+#endif
+#if OSH_TRACE_AMO
+_OSH_AMO_FUNCTIONS
+#endif
+#if OSH_TRACE_COLLECTIVE
+_OSH_COLLECTIVE_FUNCTIONS
+#endif
+#if OSH_TRACE_SYNC
+_OSH_SYNC_FUNCTIONS
+#endif
+#if OSH_TRACE_SETUP
+_OSH_SETUP_FUNCTIONS
+#endif
+
+#undef WRAP_CALL_VOID
+#undef WRAP_CALL_RET
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)              \
+  _OSH_WRAP_VOID(_OSH_HEAP_HOOK, _osh_world(), FN_NAME, DECL_ARGS, CALL_ARGS,  \
+                 PE, RX, TX)
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)     \
+  _OSH_WRAP_RET(_OSH_HEAP_HOOK, _osh_world(), RET_TYPE, FN_NAME, DECL_ARGS,    \
+                CALL_ARGS, PE, RX, TX)
+
+#if OSH_TRACE_MEMORY
+_OSH_MEMORY_FUNCTIONS
+#endif
+
+// the classes compiled out get wrappers that only forward, no clock reads
+// and nothing logged. once inlined, the caller's code is the same as in an
+// uninstrumented build
+#undef WRAP_CALL_VOID
+#undef WRAP_CALL_RET
+#define WRAP_CALL_VOID(FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)              \
+  _OSH_INLINE void FN_NAME DECL_ARGS { p##FN_NAME CALL_ARGS; }
+#define WRAP_CALL_RET(RET_TYPE, FN_NAME, DECL_ARGS, CALL_ARGS, PE, RX, TX)     \
+  _OSH_INLINE RET_TYPE FN_NAME DECL_ARGS { return p##FN_NAME CALL_ARGS; }
+#undef WRAP_CALL_TEAM_VOID
+#undef WRAP_CALL_TEAM_RET
+#define WRAP_CALL_TEAM_VOID(TEAM, ...) WRAP_CALL_VOID(__VA_ARGS__)
+#define WRAP_CALL_TEAM_RET(TEAM, ...) WRAP_CALL_RET(__VA_ARGS__)
+
+#if !OSH_TRACE_RMA
+_OSH_RMA_FUNCTIONS
+#endif
+#if !OSH_TRACE_AMO
+_OSH_AMO_FUNCTIONS
+#endif
+#if !OSH_TRACE_COLLECTIVE
+_OSH_COLLECTIVE_FUNCTIONS
+#endif
+#if !OSH_TRACE_SYNC
+_OSH_SYNC_FUNCTIONS
+#endif
+#if !OSH_TRACE_MEMORY
+_OSH_MEMORY_FUNCTIONS
+#endif
+#if !OSH_TRACE_SETUP
+_OSH_SETUP_FUNCTIONS
+#endif
 
-WRAP_CALL_RET(void *, shmem_malloc, (size_t size), (size), -1, 0, size)
-WRAP_CALL_VOID(shmem_free, (void *ptr), (ptr), -1, 0, 0)
+#undef WRAP_CALL_VOID
+#undef WRAP_CALL_RET
+#undef WRAP_CALL_TEAM_VOID
+#undef WRAP_CALL_TEAM_RET
 
 #endif /* _SHMEM_H */